@@ -0,0 +1,492 @@
+/*
+ * I/O scheduler replay benchmark
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Loading the module reads a binary blktrace stream (as written by
+ * "blkparse -d"), registers a memoryless disk whose request_fn models
+ * service time with an hrtimer, and replays the queued (Q) reads and
+ * writes of the trace against it once per elevator. For each elevator it
+ * prints throughput, request and merge counts, and latency percentiles
+ * for reads, sync writes and async writes. The module intentionally fails
+ * to load with -EAGAIN so it can be run again.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/blktrace_api.h>
+#include <linux/bio.h>
+#include <linux/elevator.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+
+static char *trace = "/data/local/tmp/trace.bin";
+module_param(trace, charp, S_IRUGO);
+MODULE_PARM_DESC(trace, "binary blktrace file to replay");
+
+static char *elevators = "noop,deadline,row,cfq,sio,vr";
+module_param(elevators, charp, S_IRUGO);
+MODULE_PARM_DESC(elevators, "comma separated elevators to compare");
+
+static unsigned int pace = 1;
+module_param(pace, uint, S_IRUGO);
+MODULE_PARM_DESC(pace, "submit at the trace's timestamps (0: back to back)");
+
+static unsigned int depth = 1;
+module_param(depth, uint, S_IRUGO);
+MODULE_PARM_DESC(depth, "requests the modelled device takes at once");
+
+static unsigned int cmd_us = 100;
+module_param(cmd_us, uint, S_IRUGO);
+MODULE_PARM_DESC(cmd_us, "fixed cost of each request, usec");
+
+static unsigned int seek_us = 400;
+module_param(seek_us, uint, S_IRUGO);
+MODULE_PARM_DESC(seek_us, "extra cost of a non-sequential request, usec");
+
+static unsigned int read_ns = 5000;
+module_param(read_ns, uint, S_IRUGO);
+MODULE_PARM_DESC(read_ns, "read transfer time per sector, nsec");
+
+static unsigned int write_ns = 20000;
+module_param(write_ns, uint, S_IRUGO);
+MODULE_PARM_DESC(write_ns, "write transfer time per sector, nsec");
+
+#define BENCH_MAX_TRACE		(64 << 20)
+#define BENCH_MAX_SECTORS	1024
+
+enum bench_class {
+	BENCH_READ,
+	BENCH_SYNC_WRITE,
+	BENCH_ASYNC_WRITE,
+	BENCH_NR_CLASSES,
+};
+
+static const char * const class_names[] = { "read", "swrite", "write" };
+
+struct bench_io {
+	u64		time;		/* ns since the start of the trace */
+	sector_t	sector;
+	unsigned int	sectors;
+	enum bench_class class;
+	ktime_t		submit;
+	u32		lat_us;
+};
+
+/* the modelled device: serves the requests it fetched one at a time */
+static struct {
+	spinlock_t		lock;
+	struct request_queue	*queue;
+	struct gendisk		*disk;
+	struct block_device	*bdev;
+	int			major;
+
+	struct list_head	inflight;
+	unsigned int		nr_inflight;
+	sector_t		last_end;
+	struct hrtimer		timer;
+	bool			busy;
+
+	unsigned long		requests;
+	unsigned long		merges;
+} dev;
+
+static atomic_t pending;
+static DECLARE_COMPLETION(done);
+
+static u64 bench_service_ns(struct request *rq)
+{
+	u64 ns = (u64)cmd_us * NSEC_PER_USEC;
+
+	if (blk_rq_pos(rq) != dev.last_end)
+		ns += (u64)seek_us * NSEC_PER_USEC;
+	ns += (u64)blk_rq_sectors(rq) *
+		(rq_data_dir(rq) == WRITE ? write_ns : read_ns);
+	return ns;
+}
+
+/* Caller must hold dev.lock */
+static void bench_start_next(void)
+{
+	struct request *rq;
+
+	if (list_empty(&dev.inflight) || dev.busy)
+		return;
+	dev.busy = true;
+	rq = list_first_entry(&dev.inflight, struct request, queuelist);
+	hrtimer_start(&dev.timer, ns_to_ktime(bench_service_ns(rq)),
+		      HRTIMER_MODE_REL);
+}
+
+static enum hrtimer_restart bench_complete(struct hrtimer *timer)
+{
+	struct request *rq;
+	struct bio *bio;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev.lock, flags);
+	dev.busy = false;
+	rq = list_first_entry(&dev.inflight, struct request, queuelist);
+	list_del_init(&rq->queuelist);
+	dev.nr_inflight--;
+	dev.last_end = blk_rq_pos(rq) + blk_rq_sectors(rq);
+	dev.requests++;
+	for (bio = rq->bio; bio; bio = bio->bi_next)
+		dev.merges++;
+	dev.merges--;
+	__blk_end_request_all(rq, 0);
+	__blk_run_queue(dev.queue);
+	bench_start_next();
+	spin_unlock_irqrestore(&dev.lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+static void bench_request_fn(struct request_queue *q)
+{
+	struct request *rq;
+
+	while (dev.nr_inflight < depth && (rq = blk_fetch_request(q))) {
+		if (rq->cmd_type != REQ_TYPE_FS) {
+			__blk_end_request_all(rq, -EIO);
+			continue;
+		}
+		list_add_tail(&rq->queuelist, &dev.inflight);
+		dev.nr_inflight++;
+	}
+	bench_start_next();
+}
+
+static const struct block_device_operations bench_fops = {
+	.owner = THIS_MODULE,
+};
+
+static int bench_dev_setup(sector_t capacity)
+{
+	int ret;
+
+	spin_lock_init(&dev.lock);
+	INIT_LIST_HEAD(&dev.inflight);
+	hrtimer_init(&dev.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dev.timer.function = bench_complete;
+
+	dev.major = register_blkdev(0, "iosched_bench");
+	if (dev.major < 0)
+		return dev.major;
+
+	ret = -ENOMEM;
+	dev.queue = blk_init_queue(bench_request_fn, &dev.lock);
+	if (!dev.queue)
+		goto err_queue;
+	blk_queue_max_hw_sectors(dev.queue, BENCH_MAX_SECTORS);
+
+	/* a single minor, so add_disk() does not scan for partitions */
+	dev.disk = alloc_disk(1);
+	if (!dev.disk)
+		goto err_disk;
+	dev.disk->major = dev.major;
+	dev.disk->first_minor = 0;
+	dev.disk->fops = &bench_fops;
+	dev.disk->queue = dev.queue;
+	strcpy(dev.disk->disk_name, "iosched_bench");
+	set_capacity(dev.disk, capacity);
+	add_disk(dev.disk);
+
+	dev.bdev = bdget_disk(dev.disk, 0);
+	if (!dev.bdev)
+		goto err_bdev;
+	ret = blkdev_get(dev.bdev, FMODE_READ | FMODE_WRITE, NULL);
+	if (ret)
+		goto err_bdev;
+	return 0;
+
+err_bdev:
+	del_gendisk(dev.disk);
+	put_disk(dev.disk);
+err_disk:
+	blk_cleanup_queue(dev.queue);
+err_queue:
+	unregister_blkdev(dev.major, "iosched_bench");
+	return ret;
+}
+
+static void bench_dev_teardown(void)
+{
+	blkdev_put(dev.bdev, FMODE_READ | FMODE_WRITE);
+	del_gendisk(dev.disk);
+	put_disk(dev.disk);
+	blk_cleanup_queue(dev.queue);
+	unregister_blkdev(dev.major, "iosched_bench");
+}
+
+static int bench_cmp_io(const void *a, const void *b)
+{
+	const struct bench_io *x = a, *y = b;
+
+	return x->time < y->time ? -1 : x->time > y->time;
+}
+
+/*
+ * Collect the Q events of the trace, in time order. Returns the number
+ * of ios, never zero, and sets *capacity past the highest sector touched.
+ */
+static int bench_parse(const char *buf, size_t size, struct bench_io **iosp,
+		       sector_t *capacity)
+{
+	const struct blk_io_trace *t;
+	struct bench_io *ios;
+	size_t off, max = size / sizeof(*t);
+	int nr = 0;
+
+	ios = vmalloc(max * sizeof(*ios));
+	if (!ios)
+		return -ENOMEM;
+
+	*capacity = 0;
+	for (off = 0; off + sizeof(*t) <= size;
+	     off += sizeof(*t) + t->pdu_len) {
+		t = (const struct blk_io_trace *)(buf + off);
+		if ((t->magic & 0xffffff00) != BLK_IO_TRACE_MAGIC ||
+		    (t->magic & 0xff) != BLK_IO_TRACE_VERSION) {
+			vfree(ios);
+			return -EINVAL;
+		}
+		if ((t->action & 0xffff) != __BLK_TA_QUEUE || !t->bytes ||
+		    (t->action & BLK_TC_ACT(BLK_TC_DISCARD)))
+			continue;
+
+		ios[nr].time = t->time;
+		ios[nr].sector = t->sector;
+		ios[nr].sectors = min_t(unsigned int, t->bytes >> 9,
+					BENCH_MAX_SECTORS);
+		if (!(t->action & BLK_TC_ACT(BLK_TC_WRITE)))
+			ios[nr].class = BENCH_READ;
+		else if (t->action & BLK_TC_ACT(BLK_TC_SYNC))
+			ios[nr].class = BENCH_SYNC_WRITE;
+		else
+			ios[nr].class = BENCH_ASYNC_WRITE;
+		if (ios[nr].sector + ios[nr].sectors > *capacity)
+			*capacity = ios[nr].sector + ios[nr].sectors;
+		nr++;
+	}
+
+	if (!nr) {
+		vfree(ios);
+		return -ENODATA;
+	}
+	/* per-cpu streams are only roughly merged by blkparse */
+	sort(ios, nr, sizeof(*ios), bench_cmp_io, NULL);
+	*iosp = ios;
+	return nr;
+}
+
+static int bench_read_trace(struct bench_io **iosp, sector_t *capacity)
+{
+	struct file *file;
+	loff_t size;
+	char *buf;
+	int ret;
+
+	file = filp_open(trace, O_RDONLY, 0);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+
+	size = i_size_read(file->f_path.dentry->d_inode);
+	ret = -EFBIG;
+	if (size > BENCH_MAX_TRACE)
+		goto out;
+	ret = -ENOMEM;
+	buf = vmalloc(size);
+	if (!buf)
+		goto out;
+
+	ret = kernel_read(file, 0, buf, size);
+	if (ret == size)
+		ret = bench_parse(buf, size, iosp, capacity);
+	else if (ret >= 0)
+		ret = -EIO;
+	vfree(buf);
+out:
+	filp_close(file, NULL);
+	return ret;
+}
+
+static void bench_end_io(struct bio *bio, int err)
+{
+	struct bench_io *io = bio->bi_private;
+
+	io->lat_us = ktime_us_delta(ktime_get(), io->submit);
+	bio_put(bio);
+	if (atomic_dec_and_test(&pending))
+		complete(&done);
+}
+
+static void bench_submit(struct bench_io *io)
+{
+	unsigned int left = io->sectors << 9, len;
+	struct bio *bio;
+	int rw;
+
+	bio = bio_alloc(GFP_KERNEL, DIV_ROUND_UP(left, PAGE_SIZE));
+	bio->bi_bdev = dev.bdev;
+	bio->bi_sector = io->sector;
+	bio->bi_end_io = bench_end_io;
+	bio->bi_private = io;
+	/* the device never touches data, so every segment is the zero page */
+	while (left) {
+		len = min_t(unsigned int, left, PAGE_SIZE);
+		if (!bio_add_page(bio, ZERO_PAGE(0), len, 0))
+			break;
+		left -= len;
+	}
+
+	if (io->class == BENCH_READ)
+		rw = READ;
+	else if (io->class == BENCH_SYNC_WRITE)
+		rw = WRITE_SYNC;
+	else
+		rw = WRITE;
+
+	atomic_inc(&pending);
+	io->submit = ktime_get();
+	submit_bio(rw, bio);
+}
+
+static int bench_cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void bench_report_class(struct bench_io *ios, int nr, u32 *lat,
+			       enum bench_class class)
+{
+	int i, n = 0;
+
+	for (i = 0; i < nr; i++)
+		if (ios[i].class == class)
+			lat[n++] = ios[i].lat_us;
+	if (!n)
+		return;
+	sort(lat, n, sizeof(*lat), bench_cmp_u32, NULL);
+	printk(KERN_INFO "iosched_bench:   %-6s %6d ios, usec p50 %u "
+	       "p90 %u p99 %u max %u\n", class_names[class], n,
+	       lat[n / 2], lat[n * 9 / 10], lat[n * 99 / 100], lat[n - 1]);
+}
+
+static int bench_run(const char *name, struct bench_io *ios, int nr,
+		     u32 *lat)
+{
+	ktime_t start, now;
+	u64 bytes = 0, ms;
+	int i, c, ret;
+
+	ret = elevator_change(dev.queue, name);
+	if (ret)
+		return ret;
+
+	dev.requests = 0;
+	dev.merges = 0;
+	dev.last_end = 0;
+	atomic_set(&pending, 1);
+	INIT_COMPLETION(done);
+
+	start = ktime_get();
+	for (i = 0; i < nr; i++) {
+		if (pace) {
+			ktime_t at = ktime_add_ns(start, ios[i].time -
+						  ios[0].time);
+
+			now = ktime_get();
+			if (ktime_to_ns(ktime_sub(at, now)) > 0) {
+				set_current_state(TASK_UNINTERRUPTIBLE);
+				schedule_hrtimeout(&at, HRTIMER_MODE_ABS);
+			}
+		}
+		bench_submit(&ios[i]);
+		bytes += ios[i].sectors << 9;
+	}
+	if (!atomic_dec_and_test(&pending))
+		wait_for_completion(&done);
+	ms = ktime_to_ms(ktime_sub(ktime_get(), start));
+
+	printk(KERN_INFO "iosched_bench: %-8s %llu KB in %llu ms (%llu KB/s), "
+	       "%lu requests, %lu merges\n", name, bytes >> 10, ms,
+	       ms ? div64_u64((bytes >> 10) * MSEC_PER_SEC, ms) : 0,
+	       dev.requests, dev.merges);
+	for (c = 0; c < BENCH_NR_CLASSES; c++)
+		bench_report_class(ios, nr, lat, c);
+	return 0;
+}
+
+static int __init iosched_bench_init(void)
+{
+	struct bench_io *ios;
+	sector_t capacity;
+	char *list, *p, *name;
+	u32 *lat;
+	int nr, ret;
+
+	nr = bench_read_trace(&ios, &capacity);
+	if (nr < 0) {
+		printk(KERN_ERR "iosched_bench: cannot read %s: %d\n",
+		       trace, nr);
+		return nr;
+	}
+
+	ret = -ENOMEM;
+	lat = vmalloc(nr * sizeof(*lat));
+	list = kstrdup(elevators, GFP_KERNEL);
+	if (!lat || !list)
+		goto out;
+
+	ret = bench_dev_setup(capacity);
+	if (ret)
+		goto out;
+
+	printk(KERN_INFO "iosched_bench: %d ios from %s, depth %u%s\n",
+	       nr, trace, depth, pace ? "" : ", unpaced");
+
+	p = list;
+	while ((name = strsep(&p, ",")) != NULL) {
+		if (!*name)
+			continue;
+		ret = bench_run(name, ios, nr, lat);
+		if (ret)
+			printk(KERN_ERR "iosched_bench: %s unavailable: %d\n",
+			       name, ret);
+		cond_resched();
+	}
+
+	bench_dev_teardown();
+	/* don't stay loaded, so the benchmark can simply be run again */
+	ret = -EAGAIN;
+out:
+	kfree(list);
+	vfree(lat);
+	vfree(ios);
+	return ret;
+}
+
+module_init(iosched_bench_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("I/O scheduler trace replay benchmark");
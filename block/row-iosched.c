@@ -80,10 +80,32 @@ static const int queue_quantum[] = {
 	1	/* ROWQ_PRIO_LOW_SWRITE */
 };
 
+/*
+ * Default dispatch-to-completion latency targets, used when latency mode
+ * is enabled. Zero means the queue has no target.
+ */
+static const int queue_target_usec[] = {
+	5000,	/* ROWQ_PRIO_HIGH_READ */
+	10000,	/* ROWQ_PRIO_REG_READ */
+	50000,	/* ROWQ_PRIO_LOW_READ */
+	0,	/* ROWQ_PRIO_HIGH_SWRITE */
+	0,	/* ROWQ_PRIO_REG_SWRITE */
+	0,	/* ROWQ_PRIO_REG_WRITE */
+	0	/* ROWQ_PRIO_LOW_SWRITE */
+};
+
 /* Default values for idling on read queues */
 #define ROW_IDLE_TIME_MSEC 25	/* msec */
 #define ROW_READ_FREQ_MSEC 100	/* msec */
 
+/*
+ * Latency histogram: bucket 0 counts completions under
+ * 2^ROW_LAT_HIST_SHIFT usec, each following bucket doubles the bound and
+ * the last one takes everything above.
+ */
+#define ROW_LAT_HIST_SHIFT	7
+#define ROW_LAT_HIST_BUCKETS	12
+
 /**
  * struct rowq_idling_data -  parameters for idling on the queue
  * @last_insert_time:	time the last request was inserted
@@ -105,6 +127,9 @@ struct rowq_idling_data {
  *			the current dispatch cycle
  * @slice:		number of requests to dispatch in a cycle
  * @idle_data:		data for idling on queues
+ * @target_usec:	dispatch-to-completion latency target, 0 for none
+ * @avg_lat_usec:	running average of dispatch-to-completion latency
+ * @lat_hist:		histogram of dispatch-to-completion latencies
  *
  */
 struct row_queue {
@@ -117,6 +142,10 @@ struct row_queue {
 
 	/* used only for READ queues */
 	struct rowq_idling_data	idle_data;
+
+	int			target_usec;
+	unsigned long		avg_lat_usec;
+	unsigned long		lat_hist[ROW_LAT_HIST_BUCKETS];
 };
 
 /**
@@ -147,6 +176,10 @@ struct idling_data {
  *			scheduler, nr_reqs[1] holds the number of all WRITE
  *			requests in scheduler
  * @cycle_flags:	used for marking unserved queueus
+ * @latency_mode:	adjust quanta to meet the queues latency targets
+ *
+ * In latency mode each queue dispatches up to eff_quantum requests per
+ * cycle instead of disp_quantum. See row_adjust_quanta().
  *
  */
 struct row_data {
@@ -155,6 +188,7 @@ struct row_data {
 	struct {
 		struct row_queue	rqueue;
 		int			disp_quantum;
+		int			eff_quantum;
 	} row_queues[ROWQ_MAX_PRIO];
 
 	enum row_queue_prio		curr_queue;
@@ -163,9 +197,13 @@ struct row_data {
 	unsigned int			nr_reqs[2];
 
 	unsigned int			cycle_flags;
+
+	int				latency_mode;
 };
 
 #define RQ_ROWQ(rq) ((struct row_queue *) ((rq)->elevator_private[0]))
+/* dispatch time in usec, 0 while the request is not dispatched */
+#define RQ_DISP_USEC(rq) ((unsigned long) ((rq)->elevator_private[1]))
 
 #define row_log(q, fmt, args...)   \
 	blk_add_trace_msg(q, "%s():" fmt , __func__, ##args)
@@ -191,6 +229,14 @@ static inline int row_rowq_unserved(struct row_data *rd,
 	return rd->cycle_flags & (1 << qnum);
 }
 
+static inline int row_rowq_quantum(struct row_data *rd,
+				   enum row_queue_prio qnum)
+{
+	if (rd->latency_mode)
+		return rd->row_queues[qnum].eff_quantum;
+	return rd->row_queues[qnum].disp_quantum;
+}
+
 /******************** Static helper functions ***********************/
 /*
  * kick_queue() - Wake up device driver queue thread
@@ -221,6 +267,45 @@ static void kick_queue(struct work_struct *work)
 	}
 }
 
+/*
+ * row_adjust_quanta() - Adjust effective quanta to the latency targets
+ * @rd:	pointer to struct row_data
+ *
+ * Walking from the highest priority, the first queue whose average
+ * latency exceeds its target halves the effective quantum of every
+ * lower priority queue. If all targets are met, lower priority queues
+ * grow back by one request per cycle up to their configured quantum.
+ * A queue's own quantum is never reduced for missing its target.
+ */
+static void row_adjust_quanta(struct row_data *rd)
+{
+	struct row_queue *rqueue;
+	int i, missed = ROWQ_MAX_PRIO;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		rqueue = &rd->row_queues[i].rqueue;
+		if (rqueue->target_usec &&
+		    rqueue->avg_lat_usec > rqueue->target_usec) {
+			missed = i;
+			break;
+		}
+	}
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		int *eff = &rd->row_queues[i].eff_quantum;
+
+		if (i > missed)
+			*eff = max(*eff / 2, 1);
+		else if (*eff < rd->row_queues[i].disp_quantum)
+			(*eff)++;
+		else
+			*eff = rd->row_queues[i].disp_quantum;
+	}
+	if (missed < ROWQ_MAX_PRIO)
+		row_log_rowq(rd, missed, "Missed latency target, avg %lu",
+			     rd->row_queues[missed].rqueue.avg_lat_usec);
+}
+
 /*
  * row_restart_disp_cycle() - Restart the dispatch cycle
  * @rd:	pointer to struct row_data
@@ -229,6 +314,7 @@ static void kick_queue(struct work_struct *work)
  * - Setting current queue to ROWQ_PRIO_HIGH_READ
  * - For each queue: reset the number of requests dispatched in
  *   the cycle
+ * - In latency mode, adjusting the effective quanta
  */
 static inline void row_restart_disp_cycle(struct row_data *rd)
 {
@@ -236,6 +322,8 @@ static inline void row_restart_disp_cycle(struct row_data *rd)
 
 	for (i = 0; i < ROWQ_MAX_PRIO; i++)
 		rd->row_queues[i].rqueue.nr_dispatched = 0;
+	if (rd->latency_mode)
+		row_adjust_quanta(rd);
 
 	rd->curr_queue = ROWQ_PRIO_HIGH_READ;
 	row_log(rd->dispatch_queue, "Restarting cycle");
@@ -317,6 +405,7 @@ static int row_reinsert_req(struct request_queue *q,
 
 	list_add(&rq->queuelist, &rqueue->fifo);
 	rd->nr_reqs[rq_data_dir(rq)]++;
+	rq->elevator_private[1] = NULL;
 
 	row_log_rowq(rd, rqueue->prio, "request reinserted");
 
@@ -374,6 +463,8 @@ static void row_dispatch_insert(struct row_data *rd)
 
 	rq = rq_entry_fifo(rd->row_queues[rd->curr_queue].rqueue.fifo.next);
 	row_remove_request(rd->dispatch_queue, rq);
+	rq->elevator_private[1] =
+		(void *)((unsigned long)ktime_to_us(ktime_get()) | 1);
 	elv_dispatch_add_tail(rd->dispatch_queue, rq);
 	rd->row_queues[rd->curr_queue].rqueue.nr_dispatched++;
 	row_clear_rowq_unserved(rd, rd->curr_queue);
@@ -447,7 +538,7 @@ static int row_dispatch_requests(struct request_queue *q, int force)
 	}
 
 	if (rd->row_queues[currq].rqueue.nr_dispatched >=
-	    rd->row_queues[currq].disp_quantum) {
+	    row_rowq_quantum(rd, currq)) {
 		rd->row_queues[currq].rqueue.nr_dispatched = 0;
 		row_log_rowq(rd, currq, "Expiring rqueue");
 		ret = row_choose_queue(rd);
@@ -522,6 +613,8 @@ static void *row_init_queue(struct request_queue *q)
 	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
 		INIT_LIST_HEAD(&rdata->row_queues[i].rqueue.fifo);
 		rdata->row_queues[i].disp_quantum = queue_quantum[i];
+		rdata->row_queues[i].eff_quantum = queue_quantum[i];
+		rdata->row_queues[i].rqueue.target_usec = queue_target_usec[i];
 		rdata->row_queues[i].rqueue.rdata = rdata;
 		rdata->row_queues[i].rqueue.prio = i;
 		rdata->row_queues[i].rqueue.idle_data.begin_idling = false;
@@ -587,6 +680,33 @@ static void row_merged_requests(struct request_queue *q, struct request *rq,
 	rqueue->rdata->nr_reqs[rq_data_dir(rq)]--;
 }
 
+/*
+ * row_completed_req() - Account a completed request
+ * @q:		requests queue
+ * @rq:		completed request
+ *
+ * Records the request's dispatch-to-completion latency in its queue's
+ * histogram and running average (weight 1/8).
+ */
+static void row_completed_req(struct request_queue *q, struct request *rq)
+{
+	struct row_queue *rqueue = RQ_ROWQ(rq);
+	unsigned long lat, disp = RQ_DISP_USEC(rq);
+	int bucket;
+
+	if (!disp)
+		return;
+	rq->elevator_private[1] = NULL;
+	lat = ((unsigned long)ktime_to_us(ktime_get()) | 1) - disp;
+
+	bucket = fls(lat >> ROW_LAT_HIST_SHIFT);
+	if (bucket >= ROW_LAT_HIST_BUCKETS)
+		bucket = ROW_LAT_HIST_BUCKETS - 1;
+	rqueue->lat_hist[bucket]++;
+	rqueue->avg_lat_usec = rqueue->avg_lat_usec -
+		(rqueue->avg_lat_usec >> 3) + (lat >> 3);
+}
+
 /*
  * get_queue_type() - Get queue type for a given request
  *
@@ -626,6 +746,7 @@ row_set_request(struct request_queue *q, struct request *rq, gfp_t gfp_mask)
 	spin_lock_irqsave(q->queue_lock, flags);
 	rq->elevator_private[0] =
 		(void *)(&rd->row_queues[get_queue_type(rq)]);
+	rq->elevator_private[1] = NULL;
 	spin_unlock_irqrestore(q->queue_lock, flags);
 
 	return 0;
@@ -670,8 +791,47 @@ SHOW_FUNCTION(row_lp_swrite_quantum_show,
 	rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].disp_quantum, 0);
 SHOW_FUNCTION(row_read_idle_show, rowd->read_idle.idle_time, 1);
 SHOW_FUNCTION(row_read_idle_freq_show, rowd->read_idle.freq, 0);
+SHOW_FUNCTION(row_latency_mode_show, rowd->latency_mode, 0);
+SHOW_FUNCTION(row_hp_read_target_show,
+	rowd->row_queues[ROWQ_PRIO_HIGH_READ].rqueue.target_usec, 0);
+SHOW_FUNCTION(row_rp_read_target_show,
+	rowd->row_queues[ROWQ_PRIO_REG_READ].rqueue.target_usec, 0);
+SHOW_FUNCTION(row_lp_read_target_show,
+	rowd->row_queues[ROWQ_PRIO_LOW_READ].rqueue.target_usec, 0);
+SHOW_FUNCTION(row_hp_swrite_target_show,
+	rowd->row_queues[ROWQ_PRIO_HIGH_SWRITE].rqueue.target_usec, 0);
+SHOW_FUNCTION(row_rp_swrite_target_show,
+	rowd->row_queues[ROWQ_PRIO_REG_SWRITE].rqueue.target_usec, 0);
+SHOW_FUNCTION(row_rp_write_target_show,
+	rowd->row_queues[ROWQ_PRIO_REG_WRITE].rqueue.target_usec, 0);
+SHOW_FUNCTION(row_lp_swrite_target_show,
+	rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].rqueue.target_usec, 0);
 #undef SHOW_FUNCTION
 
+/*
+ * One line per queue: target and average latency (usec), current
+ * effective quantum, then the latency histogram buckets.
+ */
+static ssize_t row_latency_hist_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+	struct row_queue *rqueue;
+	int i, b, len = 0;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		rqueue = &rowd->row_queues[i].rqueue;
+		len += scnprintf(page + len, PAGE_SIZE - len,
+				 "rowq%d %d %lu %d", i, rqueue->target_usec,
+				 rqueue->avg_lat_usec,
+				 row_rowq_quantum(rowd, i));
+		for (b = 0; b < ROW_LAT_HIST_BUCKETS; b++)
+			len += scnprintf(page + len, PAGE_SIZE - len, " %lu",
+					 rqueue->lat_hist[b]);
+		len += scnprintf(page + len, PAGE_SIZE - len, "\n");
+	}
+	return len;
+}
+
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
 static ssize_t __FUNC(struct elevator_queue *e,				\
 		const char *page, size_t count)				\
@@ -710,6 +870,28 @@ STORE_FUNCTION(row_lp_swrite_quantum_store,
 			1, INT_MAX, 1);
 STORE_FUNCTION(row_read_idle_store, &rowd->read_idle.idle_time, 1, INT_MAX, 1);
 STORE_FUNCTION(row_read_idle_freq_store, &rowd->read_idle.freq, 1, INT_MAX, 0);
+STORE_FUNCTION(row_latency_mode_store, &rowd->latency_mode, 0, 1, 0);
+STORE_FUNCTION(row_hp_read_target_store,
+			&rowd->row_queues[ROWQ_PRIO_HIGH_READ].rqueue.target_usec,
+			0, INT_MAX, 0);
+STORE_FUNCTION(row_rp_read_target_store,
+			&rowd->row_queues[ROWQ_PRIO_REG_READ].rqueue.target_usec,
+			0, INT_MAX, 0);
+STORE_FUNCTION(row_lp_read_target_store,
+			&rowd->row_queues[ROWQ_PRIO_LOW_READ].rqueue.target_usec,
+			0, INT_MAX, 0);
+STORE_FUNCTION(row_hp_swrite_target_store,
+		&rowd->row_queues[ROWQ_PRIO_HIGH_SWRITE].rqueue.target_usec,
+			0, INT_MAX, 0);
+STORE_FUNCTION(row_rp_swrite_target_store,
+			&rowd->row_queues[ROWQ_PRIO_REG_SWRITE].rqueue.target_usec,
+			0, INT_MAX, 0);
+STORE_FUNCTION(row_rp_write_target_store,
+			&rowd->row_queues[ROWQ_PRIO_REG_WRITE].rqueue.target_usec,
+			0, INT_MAX, 0);
+STORE_FUNCTION(row_lp_swrite_target_store,
+		&rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].rqueue.target_usec,
+			0, INT_MAX, 0);
 
 #undef STORE_FUNCTION
 
@@ -727,6 +909,15 @@ static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(lp_swrite_quantum),
 	ROW_ATTR(read_idle),
 	ROW_ATTR(read_idle_freq),
+	ROW_ATTR(latency_mode),
+	ROW_ATTR(hp_read_target),
+	ROW_ATTR(rp_read_target),
+	ROW_ATTR(lp_read_target),
+	ROW_ATTR(hp_swrite_target),
+	ROW_ATTR(rp_swrite_target),
+	ROW_ATTR(rp_write_target),
+	ROW_ATTR(lp_swrite_target),
+	__ATTR(latency_hist, S_IRUGO, row_latency_hist_show, NULL),
 	__ATTR_NULL
 };
 
@@ -739,6 +930,7 @@ static struct elevator_type iosched_row = {
 		.elevator_is_urgent_fn		= row_urgent_pending,
 		.elevator_former_req_fn		= elv_rb_former_request,
 		.elevator_latter_req_fn		= elv_rb_latter_request,
+		.elevator_completed_req_fn	= row_completed_req,
 		.elevator_set_req_fn		= row_set_request,
 		.elevator_init_fn		= row_init_queue,
 		.elevator_exit_fn		= row_exit_queue,
@@ -0,0 +1,665 @@
+/*
+ * drivers/cpufreq/cpufreq_bench.c
+ *
+ * cpufreq governor trace replay benchmark
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Loading the module reads a per-cpu load trace and replays it once per
+ * governor. A bound kthread per cpu generates the load by spinning for
+ * the traced share of every period and sleeping for the rest, so the
+ * governor samples it the same way it samples real work. For each
+ * governor and cpu it prints the number of speed changes, the time spent
+ * at each frequency, and how long the cpu took to reach its maximum
+ * speed after each load step.
+ *
+ * The trace is text, one step per line:
+ *
+ *	<duration ms> <cpu0 load %> <cpu1 load %> ...
+ *
+ * with loads relative to the capacity at the maximum speed; missing
+ * columns are idle and lines starting with '#' are ignored.
+ *
+ * If no cpufreq driver is registered the module registers a fake one
+ * whose speeds come from the freqs parameter. Changing speed then does
+ * not change how fast the cpu runs, so the load threads stretch their
+ * busy time by max/cur to model it. Otherwise the running driver is used
+ * and the cpus' governors are restored afterwards. The module
+ * intentionally fails to load with -EAGAIN so it can be run again.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/cpu.h>
+#include <linux/cpufreq.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+
+static char *trace = "/data/local/tmp/load.trace";
+module_param(trace, charp, S_IRUGO);
+MODULE_PARM_DESC(trace, "per-cpu load trace to replay");
+
+static char *governors = "interactive,ondemand,conservative,pegasusq,"
+	"smartass2,lulzactive,lionheart,brazilianwax,lagfree";
+module_param(governors, charp, S_IRUGO);
+MODULE_PARM_DESC(governors, "comma separated governors to compare");
+
+static char *freqs = "102000,204000,340000,475000,640000,760000,"
+	"860000,1000000,1100000,1200000,1300000";
+module_param(freqs, charp, S_IRUGO);
+MODULE_PARM_DESC(freqs, "comma separated speeds of the fake driver, kHz");
+
+static unsigned int latency_us = 100;
+module_param(latency_us, uint, S_IRUGO);
+MODULE_PARM_DESC(latency_us, "transition latency the fake driver reports");
+
+static unsigned int period_us = 10000;
+module_param(period_us, uint, S_IRUGO);
+MODULE_PARM_DESC(period_us, "period the load is spread over, usec");
+
+static unsigned int step_delta = 50;
+module_param(step_delta, uint, S_IRUGO);
+MODULE_PARM_DESC(step_delta, "load increase, in %, timed as a load step");
+
+static unsigned int settle_ms = 1000;
+module_param(settle_ms, uint, S_IRUGO);
+MODULE_PARM_DESC(settle_ms, "idle time given each governor before a run");
+
+#define BENCH_MAX_TRACE		(4 << 20)
+#define BENCH_MAX_FREQS		32
+
+struct bench_step {
+	unsigned int	ms;
+	u8		load[NR_CPUS];
+};
+
+static struct bench_step *steps;
+static int nr_steps;
+
+/* per-cpu results, protected by bench_lock */
+static struct bench_cpu {
+	struct task_struct *task;
+	unsigned int	max_freq;
+	unsigned int	cur_freq;
+	int		cur_idx;
+	ktime_t		since;
+
+	u64		residency_ns[BENCH_MAX_FREQS];
+	unsigned long	transitions;
+
+	bool		step_pending;
+	ktime_t		step_start;
+	unsigned long	steps;
+	unsigned long	steps_missed;
+	u64		step_total_us;
+	u64		step_max_us;
+} bench_cpus[NR_CPUS];
+
+static DEFINE_SPINLOCK(bench_lock);
+static bool running;
+static ktime_t run_start;
+static atomic_t pending;
+static DECLARE_COMPLETION(done);
+
+/* fake driver */
+static struct cpufreq_frequency_table bench_table[BENCH_MAX_FREQS + 1];
+static unsigned int bench_cur_khz[NR_CPUS];
+static bool fake_driver;
+
+static int bench_verify(struct cpufreq_policy *policy)
+{
+	return cpufreq_frequency_table_verify(policy, bench_table);
+}
+
+static int bench_target(struct cpufreq_policy *policy,
+			unsigned int target_freq, unsigned int relation)
+{
+	struct cpufreq_freqs freqs;
+	unsigned int idx;
+
+	if (cpufreq_frequency_table_target(policy, bench_table, target_freq,
+					   relation, &idx))
+		return -EINVAL;
+
+	freqs.cpu = policy->cpu;
+	freqs.old = bench_cur_khz[policy->cpu];
+	freqs.new = bench_table[idx].frequency;
+	if (freqs.old == freqs.new)
+		return 0;
+
+	cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
+	bench_cur_khz[policy->cpu] = freqs.new;
+	cpufreq_notify_transition(&freqs, CPUFREQ_POSTCHANGE);
+	return 0;
+}
+
+static unsigned int bench_get(unsigned int cpu)
+{
+	return bench_cur_khz[cpu];
+}
+
+static int bench_cpu_init(struct cpufreq_policy *policy)
+{
+	int ret;
+
+	ret = cpufreq_frequency_table_cpuinfo(policy, bench_table);
+	if (ret)
+		return ret;
+
+	cpufreq_frequency_table_get_attr(bench_table, policy->cpu);
+	bench_cur_khz[policy->cpu] = policy->cpuinfo.min_freq;
+	policy->cur = policy->cpuinfo.min_freq;
+	policy->cpuinfo.transition_latency = latency_us * NSEC_PER_USEC;
+	return 0;
+}
+
+static int bench_cpu_exit(struct cpufreq_policy *policy)
+{
+	cpufreq_frequency_table_put_attr(policy->cpu);
+	return 0;
+}
+
+static struct freq_attr *bench_attr[] = {
+	&cpufreq_freq_attr_scaling_available_freqs,
+	NULL,
+};
+
+static struct cpufreq_driver bench_driver = {
+	.name		= "cpufreq_bench",
+	/* speed changes are make-believe, keep loops_per_jiffy alone */
+	.flags		= CPUFREQ_CONST_LOOPS,
+	.verify		= bench_verify,
+	.target		= bench_target,
+	.get		= bench_get,
+	.init		= bench_cpu_init,
+	.exit		= bench_cpu_exit,
+	.attr		= bench_attr,
+	.owner		= THIS_MODULE,
+};
+
+static int bench_parse_freqs(void)
+{
+	char *list, *p, *f;
+	unsigned long khz;
+	int n = 0;
+
+	list = kstrdup(freqs, GFP_KERNEL);
+	if (!list)
+		return -ENOMEM;
+
+	p = list;
+	while ((f = strsep(&p, ",")) != NULL && n < BENCH_MAX_FREQS) {
+		if (kstrtoul(f, 0, &khz) || !khz)
+			continue;
+		bench_table[n].index = n;
+		bench_table[n].frequency = khz;
+		n++;
+	}
+	bench_table[n].index = n;
+	bench_table[n].frequency = CPUFREQ_TABLE_END;
+	kfree(list);
+
+	return n ? 0 : -EINVAL;
+}
+
+/* results */
+
+static int bench_freq_index(struct cpufreq_frequency_table *table,
+			    unsigned int khz)
+{
+	int i;
+
+	for (i = 0; table && i < BENCH_MAX_FREQS &&
+		    table[i].frequency != CPUFREQ_TABLE_END; i++)
+		if (table[i].frequency == khz)
+			return i;
+	return -1;
+}
+
+static void bench_account(struct bench_cpu *bc, ktime_t now)
+{
+	if (bc->cur_idx >= 0)
+		bc->residency_ns[bc->cur_idx] +=
+			ktime_to_ns(ktime_sub(now, bc->since));
+	bc->since = now;
+}
+
+/* the cpu's speed reached its maximum, or a new step started first */
+static void bench_step_end(struct bench_cpu *bc, ktime_t now, bool reached)
+{
+	u64 us;
+
+	if (!bc->step_pending)
+		return;
+
+	bc->step_pending = false;
+	if (!reached) {
+		bc->steps_missed++;
+		return;
+	}
+
+	us = ktime_to_us(ktime_sub(now, bc->step_start));
+	bc->steps++;
+	bc->step_total_us += us;
+	if (us > bc->step_max_us)
+		bc->step_max_us = us;
+}
+
+static int bench_transition(struct notifier_block *nb, unsigned long val,
+			    void *data)
+{
+	struct cpufreq_freqs *freq = data;
+	struct bench_cpu *bc = &bench_cpus[freq->cpu];
+	ktime_t now = ktime_get();
+	unsigned long flags;
+
+	if (val != CPUFREQ_POSTCHANGE)
+		return 0;
+
+	spin_lock_irqsave(&bench_lock, flags);
+	bc->cur_freq = freq->new;
+	if (running) {
+		bench_account(bc, now);
+		bc->cur_idx = bench_freq_index(
+			cpufreq_frequency_get_table(freq->cpu), freq->new);
+		bc->transitions++;
+		if (freq->new >= bc->max_freq)
+			bench_step_end(bc, now, true);
+	}
+	spin_unlock_irqrestore(&bench_lock, flags);
+
+	return 0;
+}
+
+static struct notifier_block bench_nb = {
+	.notifier_call = bench_transition,
+};
+
+/* load generation */
+
+static void bench_busy(unsigned int cpu, unsigned int load, ktime_t end)
+{
+	struct bench_cpu *bc = &bench_cpus[cpu];
+	ktime_t now = ktime_get();
+	u64 busy_ns, period_ns;
+
+	while (ktime_to_ns(ktime_sub(end, now)) > 0) {
+		period_ns = min_t(u64, (u64)period_us * NSEC_PER_USEC,
+				  ktime_to_ns(ktime_sub(end, now)));
+		busy_ns = div_u64(period_ns * load, 100);
+
+		/* the fake driver's cpu does not really slow down */
+		if (fake_driver && bc->cur_freq)
+			busy_ns = min(div_u64(busy_ns * bc->max_freq,
+					      bc->cur_freq), period_ns);
+
+		if (busy_ns) {
+			ktime_t stop = ktime_add_ns(now, busy_ns);
+
+			while (ktime_to_ns(ktime_sub(stop, ktime_get())) > 0)
+				cpu_relax();
+			cond_resched();
+		}
+
+		if (period_ns > busy_ns) {
+			ktime_t wake = ktime_add_ns(now, period_ns);
+
+			set_current_state(TASK_UNINTERRUPTIBLE);
+			schedule_hrtimeout(&wake, HRTIMER_MODE_ABS);
+		}
+		now = ktime_get();
+	}
+}
+
+static int bench_load_thread(void *data)
+{
+	unsigned int cpu = (unsigned long)data;
+	struct bench_cpu *bc = &bench_cpus[cpu];
+	unsigned int prev = 0, load;
+	unsigned long flags;
+	ktime_t end = run_start;
+	int i;
+
+	for (i = 0; i < nr_steps; i++) {
+		load = steps[i].load[cpu];
+		if (load >= prev + step_delta) {
+			ktime_t now = ktime_get();
+
+			spin_lock_irqsave(&bench_lock, flags);
+			bench_step_end(bc, now, false);
+			if (bc->cur_freq < bc->max_freq) {
+				bc->step_pending = true;
+				bc->step_start = now;
+			} else {
+				bc->steps++;
+			}
+			spin_unlock_irqrestore(&bench_lock, flags);
+		}
+		prev = load;
+
+		end = ktime_add_ns(end, (u64)steps[i].ms * NSEC_PER_MSEC);
+		bench_busy(cpu, load, end);
+	}
+
+	if (atomic_dec_and_test(&pending))
+		complete(&done);
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+	return 0;
+}
+
+/* trace */
+
+static int bench_parse(char *buf)
+{
+	char *line, *p, *tok;
+	unsigned long v;
+	int nr = 0, max = 0, cpu;
+
+	for (p = buf; *p; p++)
+		if (*p == '\n')
+			max++;
+	steps = vzalloc((max + 1) * sizeof(*steps));
+	if (!steps)
+		return -ENOMEM;
+
+	p = buf;
+	while ((line = strsep(&p, "\n")) != NULL) {
+		line = skip_spaces(line);
+		if (!*line || *line == '#')
+			continue;
+
+		tok = strsep(&line, " \t");
+		if (kstrtoul(tok, 10, &v) || !v)
+			continue;
+		steps[nr].ms = v;
+
+		cpu = 0;
+		while (line && cpu < nr_cpu_ids) {
+			tok = strsep(&line, " \t");
+			if (!*tok)
+				continue;
+			if (kstrtoul(tok, 10, &v))
+				break;
+			steps[nr].load[cpu++] = min_t(unsigned long, v, 100);
+		}
+		nr++;
+	}
+
+	if (!nr) {
+		vfree(steps);
+		steps = NULL;
+		return -ENODATA;
+	}
+	return nr;
+}
+
+static int bench_read_trace(void)
+{
+	struct file *file;
+	loff_t size;
+	char *buf;
+	int ret;
+
+	file = filp_open(trace, O_RDONLY, 0);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+
+	size = i_size_read(file->f_path.dentry->d_inode);
+	ret = -EFBIG;
+	if (size > BENCH_MAX_TRACE)
+		goto out;
+	ret = -ENOMEM;
+	buf = vmalloc(size + 1);
+	if (!buf)
+		goto out;
+
+	ret = kernel_read(file, 0, buf, size);
+	if (ret == size) {
+		buf[size] = '\0';
+		ret = bench_parse(buf);
+	} else if (ret >= 0) {
+		ret = -EIO;
+	}
+	vfree(buf);
+out:
+	filp_close(file, NULL);
+	return ret;
+}
+
+/* runs */
+
+static int bench_set_governor(unsigned int cpu, char *name)
+{
+	struct cpufreq_policy *policy = cpufreq_cpu_get(cpu);
+	bool same;
+
+	if (!policy)
+		return -ENODEV;
+	same = policy->governor &&
+		!strncmp(policy->governor->name, name, CPUFREQ_NAME_LEN);
+	cpufreq_cpu_put(policy);
+
+	return same ? 0 : cpufreq_set_gov(name, cpu);
+}
+
+static void bench_report(const char *name, unsigned int cpu, u64 run_ns)
+{
+	struct bench_cpu *bc = &bench_cpus[cpu];
+	struct cpufreq_frequency_table *table = cpufreq_frequency_get_table(cpu);
+	char buf[256];
+	u64 khz_ns = 0;
+	int i, len = 0;
+
+	for (i = 0; table && i < BENCH_MAX_FREQS &&
+		    table[i].frequency != CPUFREQ_TABLE_END; i++) {
+		if (!bc->residency_ns[i])
+			continue;
+		khz_ns += bc->residency_ns[i] * table[i].frequency;
+		len += scnprintf(buf + len, sizeof(buf) - len, " %u:%llu",
+				 table[i].frequency,
+				 div_u64(bc->residency_ns[i], NSEC_PER_MSEC));
+	}
+
+	printk(KERN_INFO "cpufreq_bench: %-12s cpu%u %lu transitions, "
+	       "avg %llu kHz, %lu steps to max avg %llu us max %llu us, "
+	       "%lu missed\n", name, cpu, bc->transitions,
+	       run_ns ? div64_u64(khz_ns, run_ns) : 0, bc->steps,
+	       bc->steps ? div_u64(bc->step_total_us, bc->steps) : 0,
+	       bc->step_max_us, bc->steps_missed);
+	printk(KERN_INFO "cpufreq_bench: %-12s cpu%u kHz:ms%s\n",
+	       name, cpu, buf);
+}
+
+static int bench_run(char *name, const struct cpumask *cpus)
+{
+	struct cpufreq_policy *policy;
+	unsigned long flags;
+	unsigned int cpu;
+	ktime_t end;
+	int ret;
+
+	for_each_cpu(cpu, cpus) {
+		ret = bench_set_governor(cpu, name);
+		if (ret)
+			return ret;
+	}
+	msleep(settle_ms);
+
+	atomic_set(&pending, cpumask_weight(cpus));
+	INIT_COMPLETION(done);
+
+	for_each_cpu(cpu, cpus) {
+		struct bench_cpu *bc = &bench_cpus[cpu];
+
+		bc->task = kthread_create(bench_load_thread,
+					  (void *)(unsigned long)cpu,
+					  "cpufreq_bench/%u", cpu);
+		if (IS_ERR(bc->task)) {
+			ret = PTR_ERR(bc->task);
+			bc->task = NULL;
+			goto stop;
+		}
+		kthread_bind(bc->task, cpu);
+	}
+
+	spin_lock_irqsave(&bench_lock, flags);
+	run_start = ktime_get();
+	for_each_cpu(cpu, cpus) {
+		struct bench_cpu *bc = &bench_cpus[cpu];
+
+		policy = cpufreq_cpu_get(cpu);
+		memset(bc->residency_ns, 0, sizeof(bc->residency_ns));
+		bc->transitions = 0;
+		bc->step_pending = false;
+		bc->steps = 0;
+		bc->steps_missed = 0;
+		bc->step_total_us = 0;
+		bc->step_max_us = 0;
+		bc->max_freq = policy ? policy->max : 0;
+		bc->cur_freq = policy ? policy->cur : 0;
+		bc->cur_idx = bench_freq_index(
+			cpufreq_frequency_get_table(cpu), bc->cur_freq);
+		bc->since = run_start;
+		if (policy)
+			cpufreq_cpu_put(policy);
+	}
+	running = true;
+	spin_unlock_irqrestore(&bench_lock, flags);
+
+	for_each_cpu(cpu, cpus)
+		wake_up_process(bench_cpus[cpu].task);
+	wait_for_completion(&done);
+	ret = 0;
+
+stop:
+	spin_lock_irqsave(&bench_lock, flags);
+	running = false;
+	end = ktime_get();
+	for_each_cpu(cpu, cpus) {
+		bench_account(&bench_cpus[cpu], end);
+		bench_step_end(&bench_cpus[cpu], end, false);
+	}
+	spin_unlock_irqrestore(&bench_lock, flags);
+
+	for_each_cpu(cpu, cpus) {
+		if (bench_cpus[cpu].task) {
+			kthread_stop(bench_cpus[cpu].task);
+			bench_cpus[cpu].task = NULL;
+		}
+	}
+
+	if (!ret)
+		for_each_cpu(cpu, cpus)
+			bench_report(name, cpu,
+				     ktime_to_ns(ktime_sub(end, run_start)));
+	return ret;
+}
+
+static int __init cpufreq_bench_init(void)
+{
+	char saved[NR_CPUS][CPUFREQ_NAME_LEN];
+	struct cpufreq_policy *policy;
+	struct cpumask cpus;
+	char *list, *p, *name;
+	unsigned int cpu;
+	int ret;
+
+	ret = bench_read_trace();
+	if (ret < 0) {
+		printk(KERN_ERR "cpufreq_bench: cannot read %s: %d\n",
+		       trace, ret);
+		return ret;
+	}
+	nr_steps = ret;
+
+	ret = -ENOMEM;
+	list = kstrdup(governors, GFP_KERNEL);
+	if (!list)
+		goto out;
+
+	ret = bench_parse_freqs();
+	if (ret)
+		goto out;
+
+	ret = cpufreq_register_driver(&bench_driver);
+	fake_driver = !ret;
+	if (ret && ret != -EBUSY)
+		goto out;
+
+	get_online_cpus();
+	cpumask_clear(&cpus);
+	for_each_online_cpu(cpu) {
+		policy = cpufreq_cpu_get(cpu);
+		if (!policy)
+			continue;
+		saved[cpu][0] = '\0';
+		if (policy->governor)
+			strlcpy(saved[cpu], policy->governor->name,
+				CPUFREQ_NAME_LEN);
+		cpufreq_cpu_put(policy);
+		cpumask_set_cpu(cpu, &cpus);
+	}
+	put_online_cpus();
+
+	printk(KERN_INFO "cpufreq_bench: %d steps from %s on %u cpus, "
+	       "%s driver\n", nr_steps, trace, cpumask_weight(&cpus),
+	       fake_driver ? "fake" : "running");
+
+	cpufreq_register_notifier(&bench_nb, CPUFREQ_TRANSITION_NOTIFIER);
+
+	p = list;
+	while ((name = strsep(&p, ",")) != NULL) {
+		if (!*name)
+			continue;
+		ret = bench_run(name, &cpus);
+		if (ret)
+			printk(KERN_ERR "cpufreq_bench: %s unavailable: %d\n",
+			       name, ret);
+	}
+
+	cpufreq_unregister_notifier(&bench_nb, CPUFREQ_TRANSITION_NOTIFIER);
+
+	if (fake_driver) {
+		cpufreq_unregister_driver(&bench_driver);
+	} else {
+		for_each_cpu(cpu, &cpus)
+			if (saved[cpu][0])
+				bench_set_governor(cpu, saved[cpu]);
+	}
+
+	/* don't stay loaded, so the benchmark can simply be run again */
+	ret = -EAGAIN;
+out:
+	kfree(list);
+	vfree(steps);
+	steps = NULL;
+	return ret;
+}
+
+module_init(cpufreq_bench_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("cpufreq governor trace replay benchmark");
@@ -54,6 +54,7 @@ struct cpufreq_interactive_cpuinfo {
 	unsigned int floor_freq;
 	u64 floor_validate_time;
 	int governor_enabled;
+	struct sched_util_hook util_hook;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
@@ -130,6 +131,13 @@ static unsigned long timer_rate;
 #define DEFAULT_ABOVE_HISPEED_DELAY DEFAULT_TIMER_RATE
 static unsigned long above_hispeed_delay_val;
 
+/*
+ * Evaluate speed from the scheduler tick using the runqueue's busy
+ * fraction instead of from a per-cpu timer. Idle cpus then take no
+ * timer wakeups and do not hold the policy up.
+ */
+static unsigned long sched_hook;
+
 /*
  * Boost pulse to hispeed on touchscreen input.
  */
@@ -240,68 +248,13 @@ static inline cputime64_t get_cpu_iowait_time(
 	return iowait_time;
 }
 
-static void cpufreq_interactive_timer(unsigned long data)
+/* load since the last speed change, timer_run_time is now */
+static int cpufreq_interactive_load_since_change(
+	struct cpufreq_interactive_cpuinfo *pcpu, u64 now_idle, u64 now_iowait)
 {
 	unsigned int delta_idle;
 	unsigned int delta_iowait;
 	unsigned int delta_time;
-	int cpu_load;
-	int load_since_change;
-	u64 time_in_idle;
-	u64 time_in_iowait;
-	u64 idle_exit_time;
-	struct cpufreq_interactive_cpuinfo *pcpu =
-		&per_cpu(cpuinfo, data);
-	u64 now_idle;
-	u64 now_iowait;
-	unsigned int new_freq;
-	unsigned int index;
-	unsigned long flags;
-
-	smp_rmb();
-
-	if (!pcpu->governor_enabled)
-		goto exit;
-
-	/*
-	 * Once pcpu->timer_run_time is updated to >= pcpu->idle_exit_time,
-	 * this lets idle exit know the current idle time sample has
-	 * been processed, and idle exit can generate a new sample and
-	 * re-arm the timer.  This prevents a concurrent idle
-	 * exit on that CPU from writing a new set of info at the same time
-	 * the timer function runs (the timer function can't use that info
-	 * until more time passes).
-	 */
-	time_in_idle = pcpu->time_in_idle;
-	time_in_iowait = pcpu->time_in_iowait;
-	idle_exit_time = pcpu->idle_exit_time;
-	now_idle = get_cpu_idle_time_us(data, &pcpu->timer_run_time);
-	now_iowait = get_cpu_iowait_time(data, NULL);
-	smp_wmb();
-
-	/* If we raced with cancelling a timer, skip. */
-	if (!idle_exit_time)
-		goto exit;
-
-	delta_idle = (unsigned int) cputime64_sub(now_idle, time_in_idle);
-	delta_iowait = (unsigned int) cputime64_sub(now_iowait, time_in_iowait);
-	delta_time = (unsigned int) cputime64_sub(pcpu->timer_run_time,
-						  idle_exit_time);
-
-	/*
-	 * If timer ran less than 1ms after short-term sample started, retry.
-	 */
-	if (delta_time < 1000)
-		goto rearm;
-
-	if (delta_idle > delta_time)
-		cpu_load = 0;
-	else {
-		if (io_is_busy && delta_idle >= delta_iowait)
-			delta_idle -= delta_iowait;
-
-		cpu_load = 100 * (delta_time - delta_idle) / delta_time;
-	}
 
 	delta_idle = (unsigned int) cputime64_sub(now_idle,
 						pcpu->freq_change_time_in_idle);
@@ -311,14 +264,26 @@ static void cpufreq_interactive_timer(unsigned long data)
 						  pcpu->freq_change_time);
 
 	if ((delta_time == 0) || (delta_idle > delta_time))
-		load_since_change = 0;
-	else {
-		if (io_is_busy && delta_idle >= delta_iowait)
-			delta_idle -= delta_iowait;
+		return 0;
 
-		load_since_change =
-			100 * (delta_time - delta_idle) / delta_time;
-	}
+	if (io_is_busy && delta_idle >= delta_iowait)
+		delta_idle -= delta_iowait;
+
+	return 100 * (delta_time - delta_idle) / delta_time;
+}
+
+/*
+ * Pick a new target speed for cpu and queue the change. Returns nonzero
+ * if the decision was put off and load should be sampled again.
+ */
+static int cpufreq_interactive_evaluate(unsigned int cpu, int cpu_load,
+					int load_since_change)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		&per_cpu(cpuinfo, cpu);
+	unsigned int new_freq;
+	unsigned int index;
+	unsigned long flags;
 
 	/*
 	 * Combine short-term load (since last idle timer started or timer
@@ -334,8 +299,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 					   new_freq, CPUFREQ_RELATION_H,
 					   &index)) {
 		pr_warn_once("timer %d: cpufreq_frequency_table_target error\n",
-			     (int) data);
-		goto rearm;
+			     (int) cpu);
+		return 1;
 	}
 
 	new_freq = pcpu->freq_table[index].frequency;
@@ -349,9 +314,9 @@ static void cpufreq_interactive_timer(unsigned long data)
 				  pcpu->floor_validate_time)
 		    < min_sample_time) {
 
-			trace_cpufreq_interactive_notyet(data, cpu_load,
+			trace_cpufreq_interactive_notyet(cpu, cpu_load,
 					pcpu->target_freq, new_freq);
-			goto rearm;
+			return 1;
 		}
 	}
 
@@ -359,29 +324,107 @@ static void cpufreq_interactive_timer(unsigned long data)
 	pcpu->floor_validate_time = pcpu->timer_run_time;
 
 	if (pcpu->target_freq == new_freq) {
-		trace_cpufreq_interactive_already(data, cpu_load,
+		trace_cpufreq_interactive_already(cpu, cpu_load,
 				pcpu->target_freq, new_freq);
-		goto rearm_if_notmax;
-	}
 
-	trace_cpufreq_interactive_target(data, cpu_load, pcpu->target_freq,
-					new_freq);
+		/*
+		 * With the scheduler hook idle cpus do not vote, so the
+		 * speed an idle cpu asked for is only dropped when a busy
+		 * one re-evaluates the policy.
+		 */
+		if (!sched_hook || pcpu->policy->cur <= new_freq ||
+		    cputime64_sub(pcpu->timer_run_time,
+				  pcpu->freq_change_time) < min_sample_time)
+			return 0;
+	} else {
+		trace_cpufreq_interactive_target(cpu, cpu_load,
+				pcpu->target_freq, new_freq);
+	}
 
-	if (new_freq < pcpu->target_freq) {
+	if (new_freq < pcpu->target_freq ||
+	    (new_freq == pcpu->target_freq && new_freq < pcpu->policy->cur)) {
 		pcpu->target_freq = new_freq;
 		spin_lock_irqsave(&down_cpumask_lock, flags);
-		cpumask_set_cpu(data, &down_cpumask);
+		cpumask_set_cpu(cpu, &down_cpumask);
 		spin_unlock_irqrestore(&down_cpumask_lock, flags);
 		queue_work(down_wq, &freq_scale_down_work);
 	} else {
 		pcpu->target_freq = new_freq;
 		spin_lock_irqsave(&up_cpumask_lock, flags);
-		cpumask_set_cpu(data, &up_cpumask);
+		cpumask_set_cpu(cpu, &up_cpumask);
 		spin_unlock_irqrestore(&up_cpumask_lock, flags);
 		wake_up_process(up_task);
 	}
 
-rearm_if_notmax:
+	return 0;
+}
+
+static void cpufreq_interactive_timer(unsigned long data)
+{
+	unsigned int delta_idle;
+	unsigned int delta_iowait;
+	unsigned int delta_time;
+	int cpu_load;
+	int load_since_change;
+	u64 time_in_idle;
+	u64 time_in_iowait;
+	u64 idle_exit_time;
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		&per_cpu(cpuinfo, data);
+	u64 now_idle;
+	u64 now_iowait;
+
+	smp_rmb();
+
+	if (!pcpu->governor_enabled || sched_hook)
+		goto exit;
+
+	/*
+	 * Once pcpu->timer_run_time is updated to >= pcpu->idle_exit_time,
+	 * this lets idle exit know the current idle time sample has
+	 * been processed, and idle exit can generate a new sample and
+	 * re-arm the timer.  This prevents a concurrent idle
+	 * exit on that CPU from writing a new set of info at the same time
+	 * the timer function runs (the timer function can't use that info
+	 * until more time passes).
+	 */
+	time_in_idle = pcpu->time_in_idle;
+	time_in_iowait = pcpu->time_in_iowait;
+	idle_exit_time = pcpu->idle_exit_time;
+	now_idle = get_cpu_idle_time_us(data, &pcpu->timer_run_time);
+	now_iowait = get_cpu_iowait_time(data, NULL);
+	smp_wmb();
+
+	/* If we raced with cancelling a timer, skip. */
+	if (!idle_exit_time)
+		goto exit;
+
+	delta_idle = (unsigned int) cputime64_sub(now_idle, time_in_idle);
+	delta_iowait = (unsigned int) cputime64_sub(now_iowait, time_in_iowait);
+	delta_time = (unsigned int) cputime64_sub(pcpu->timer_run_time,
+						  idle_exit_time);
+
+	/*
+	 * If timer ran less than 1ms after short-term sample started, retry.
+	 */
+	if (delta_time < 1000)
+		goto rearm;
+
+	if (delta_idle > delta_time)
+		cpu_load = 0;
+	else {
+		if (io_is_busy && delta_idle >= delta_iowait)
+			delta_idle -= delta_iowait;
+
+		cpu_load = 100 * (delta_time - delta_idle) / delta_time;
+	}
+
+	load_since_change = cpufreq_interactive_load_since_change(pcpu,
+						now_idle, now_iowait);
+
+	if (cpufreq_interactive_evaluate(data, cpu_load, load_since_change))
+		goto rearm;
+
 	/*
 	 * Already set max speed and don't see a need to change that,
 	 * wait until next idle to re-evaluate, don't need timer.
@@ -418,6 +461,38 @@ exit:
 	return;
 }
 
+static void cpufreq_interactive_sched_update(struct sched_util_hook *hook,
+					     unsigned long util)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		container_of(hook, struct cpufreq_interactive_cpuinfo,
+			     util_hook);
+	unsigned int cpu = smp_processor_id();
+	int cpu_load, load_since_change;
+	u64 now_idle, now_iowait, now;
+
+	smp_rmb();
+
+	if (!pcpu->governor_enabled || !sched_hook)
+		return;
+
+	now_idle = get_cpu_idle_time_us(cpu, &now);
+
+	/* same 1ms minimum sample as the timer */
+	if (cputime64_sub(now, pcpu->timer_run_time) < 1000)
+		return;
+
+	pcpu->timer_run_time = now;
+	now_iowait = get_cpu_iowait_time(cpu, NULL);
+
+	/* iowait is not part of the runqueue busy fraction */
+	cpu_load = min_t(unsigned long, util * 100 / FIXED_1, 100);
+	load_since_change = cpufreq_interactive_load_since_change(pcpu,
+						now_idle, now_iowait);
+
+	cpufreq_interactive_evaluate(cpu, cpu_load, load_since_change);
+}
+
 static void cpufreq_interactive_idle_start(void)
 {
 	struct cpufreq_interactive_cpuinfo *pcpu =
@@ -429,6 +504,11 @@ static void cpufreq_interactive_idle_start(void)
 
 	pcpu->idling = 1;
 	smp_wmb();
+
+	/* no tick and no vote while idle, nothing to re-evaluate */
+	if (sched_hook)
+		return;
+
 	pending = timer_pending(&pcpu->cpu_timer);
 
 	if (pcpu->target_freq != pcpu->policy->min) {
@@ -493,7 +573,7 @@ static void cpufreq_interactive_idle_end(void)
 	 */
 	if (timer_pending(&pcpu->cpu_timer) == 0 &&
 	    pcpu->timer_run_time >= pcpu->idle_exit_time &&
-	    pcpu->governor_enabled) {
+	    pcpu->governor_enabled && !sched_hook) {
 		pcpu->time_in_idle =
 			get_cpu_idle_time_us(smp_processor_id(),
 					     &pcpu->idle_exit_time);
@@ -549,6 +629,9 @@ static int cpufreq_interactive_up_task(void *data)
 				struct cpufreq_interactive_cpuinfo *pjcpu =
 					&per_cpu(cpuinfo, j);
 
+				if (sched_hook && j != cpu && pjcpu->idling)
+					continue;
+
 				if (pjcpu->target_freq > max_freq)
 					max_freq = pjcpu->target_freq;
 			}
@@ -600,6 +683,9 @@ static void cpufreq_interactive_freq_down(struct work_struct *work)
 			struct cpufreq_interactive_cpuinfo *pjcpu =
 				&per_cpu(cpuinfo, j);
 
+			if (sched_hook && j != cpu && pjcpu->idling)
+				continue;
+
 			if (pjcpu->target_freq > max_freq)
 				max_freq = pjcpu->target_freq;
 		}
@@ -1025,6 +1111,76 @@ static ssize_t store_timer_rate(struct kobject *kobj,
 static struct global_attr timer_rate_attr = __ATTR(timer_rate, 0644,
 		show_timer_rate, store_timer_rate);
 
+/* hook all cpus running the governor into the scheduler, or back to timers */
+/*
+ * Runs on the CPU that owns the timer, with interrupts off, so it cannot
+ * race with idle_end or the timer function arming the same timer.
+ */
+static void cpufreq_interactive_rearm_timer(void *data)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		&per_cpu(cpuinfo, smp_processor_id());
+
+	if (!pcpu->governor_enabled || timer_pending(&pcpu->cpu_timer))
+		return;
+
+	pcpu->time_in_idle = get_cpu_idle_time_us(smp_processor_id(),
+						  &pcpu->idle_exit_time);
+	pcpu->time_in_iowait = get_cpu_iowait_time(smp_processor_id(), NULL);
+	pcpu->timer_idlecancel = 0;
+	mod_timer_pinned(&pcpu->cpu_timer,
+			 jiffies + usecs_to_jiffies(timer_rate));
+}
+
+static void cpufreq_interactive_set_sched_hook(bool on)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned int j;
+
+	sched_hook = on;
+	smp_wmb();
+
+	for_each_possible_cpu(j) {
+		pcpu = &per_cpu(cpuinfo, j);
+		if (pcpu->governor_enabled)
+			sched_set_util_hook(j, on ? &pcpu->util_hook : NULL);
+	}
+
+	if (on)
+		return;
+
+	synchronize_sched();
+
+	get_online_cpus();
+	for_each_online_cpu(j)
+		smp_call_function_single(j, cpufreq_interactive_rearm_timer,
+					 NULL, 1);
+	put_online_cpus();
+}
+
+static ssize_t show_sched_hook(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", sched_hook);
+}
+
+static ssize_t store_sched_hook(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	if (!!val != !!sched_hook)
+		cpufreq_interactive_set_sched_hook(val);
+	return count;
+}
+
+static struct global_attr sched_hook_attr = __ATTR(sched_hook, 0644,
+		show_sched_hook, store_sched_hook);
+
 static ssize_t show_input_boost(struct kobject *kobj, struct attribute *attr,
 				char *buf)
 {
@@ -1086,6 +1242,7 @@ static struct attribute *interactive_attributes[] = {
 	&above_hispeed_delay.attr,
 	&min_sample_time_attr.attr,
 	&timer_rate_attr.attr,
+	&sched_hook_attr.attr,
 	&input_boost.attr,
 	&boost.attr,
 	NULL,
@@ -1132,6 +1289,8 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 				pcpu->freq_change_time;
 			pcpu->governor_enabled = 1;
 			smp_wmb();
+			if (sched_hook)
+				sched_set_util_hook(j, &pcpu->util_hook);
 		}
 
 		if (!hispeed_freq)
@@ -1157,6 +1316,10 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		break;
 
 	case CPUFREQ_GOV_STOP:
+		for_each_cpu(j, policy->cpus)
+			sched_set_util_hook(j, NULL);
+		synchronize_sched();
+
 		for_each_cpu(j, policy->cpus) {
 			pcpu = &per_cpu(cpuinfo, j);
 			pcpu->governor_enabled = 0;
@@ -1232,6 +1395,7 @@ static int __init cpufreq_interactive_init(void)
 		init_timer(&pcpu->cpu_timer);
 		pcpu->cpu_timer.function = cpufreq_interactive_timer;
 		pcpu->cpu_timer.data = i;
+		pcpu->util_hook.func = cpufreq_interactive_sched_update;
 	}
 
 	up_task = kthread_create(cpufreq_interactive_up_task, NULL,
@@ -18,11 +18,19 @@
 #include <linux/jiffies.h>
 #include <linux/percpu.h>
 #include <linux/kobject.h>
-#include <linux/spinlock.h>
 #include <linux/notifier.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <asm/cputime.h>
 
-static spinlock_t cpufreq_stats_lock;
+/*
+ * A cpu's stats are only written from its transition notifier, which the
+ * cpufreq core and governors never run concurrently for one cpu. Readers
+ * retry on stat->seq instead of taking a lock. The per-cpu pointer is
+ * RCU protected against the table being freed when the cpu goes down.
+ */
 
 #define CPUFREQ_STATDEVICE_ATTR(_name, _mode, _show) \
 static struct freq_attr _attr_##_name = {\
@@ -36,7 +44,8 @@ struct cpufreq_stats {
 	unsigned long long  last_time;
 	unsigned int max_state;
 	unsigned int state_num;
-	unsigned int last_index;
+	int last_index;
+	seqcount_t seq;
 	cputime64_t *time_in_state;
 	unsigned int *freq_table;
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
@@ -51,26 +60,15 @@ struct cpufreq_stats_attribute {
 	ssize_t(*show) (struct cpufreq_stats *, char *);
 };
 
-static int cpufreq_stats_update(unsigned int cpu)
+/* time in state i as of now, call within a stat->seq read section */
+static cputime64_t cpufreq_stats_time(struct cpufreq_stats *stat, int i,
+				      u64 cur_time)
 {
-	struct cpufreq_stats *stat;
-	unsigned long long cur_time;
+	cputime64_t t = stat->time_in_state[i];
 
-	cur_time = get_jiffies_64();
-	spin_lock(&cpufreq_stats_lock);
-	stat = per_cpu(cpufreq_stats_table, cpu);
-	if (!stat) {
-		spin_unlock(&cpufreq_stats_lock);
-		return 0;
-	}
-
-	if (stat->time_in_state && stat->last_index >= 0)
-		stat->time_in_state[stat->last_index] =
-			cputime64_add(stat->time_in_state[stat->last_index],
-				      cputime_sub(cur_time, stat->last_time));
-	stat->last_time = cur_time;
-	spin_unlock(&cpufreq_stats_lock);
-	return 0;
+	if (i == stat->last_index)
+		t = cputime64_add(t, cputime_sub(cur_time, stat->last_time));
+	return t;
 }
 
 static ssize_t show_total_trans(struct cpufreq_policy *policy, char *buf)
@@ -84,17 +82,24 @@ static ssize_t show_total_trans(struct cpufreq_policy *policy, char *buf)
 
 static ssize_t show_time_in_state(struct cpufreq_policy *policy, char *buf)
 {
-	ssize_t len = 0;
+	ssize_t len;
+	unsigned seq;
+	u64 cur_time;
 	int i;
 	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
 	if (!stat)
 		return 0;
-	cpufreq_stats_update(stat->cpu);
-	for (i = 0; i < stat->state_num; i++) {
-		len += sprintf(buf + len, "%u %llu\n", stat->freq_table[i],
-			(unsigned long long)
-			cputime64_to_clock_t(stat->time_in_state[i]));
-	}
+	do {
+		len = 0;
+		seq = read_seqcount_begin(&stat->seq);
+		cur_time = get_jiffies_64();
+		for (i = 0; i < stat->state_num; i++) {
+			len += sprintf(buf + len, "%u %llu\n",
+				stat->freq_table[i], (unsigned long long)
+				cputime64_to_clock_t(
+				cpufreq_stats_time(stat, i, cur_time)));
+		}
+	} while (read_seqcount_retry(&stat->seq, seq));
 	return len;
 }
 
@@ -107,7 +112,6 @@ static ssize_t show_trans_table(struct cpufreq_policy *policy, char *buf)
 	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
 	if (!stat)
 		return 0;
-	cpufreq_stats_update(stat->cpu);
 	len += snprintf(buf + len, PAGE_SIZE - len, "   From  :    To\n");
 	len += snprintf(buf + len, PAGE_SIZE - len, "         : ");
 	for (i = 0; i < stat->state_num; i++) {
@@ -177,12 +181,11 @@ static void cpufreq_stats_free_table(unsigned int cpu)
 {
 	struct cpufreq_stats *stat;
 
-	spin_lock(&cpufreq_stats_lock);
 	stat = per_cpu(cpufreq_stats_table, cpu);
-	per_cpu(cpufreq_stats_table, cpu) = NULL;
-	spin_unlock(&cpufreq_stats_lock);
+	rcu_assign_pointer(per_cpu(cpufreq_stats_table, cpu), NULL);
 
 	if (stat) {
+		synchronize_rcu();
 		kfree(stat->time_in_state);
 		kfree(stat);
 	}
@@ -222,10 +225,10 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 
 	ret = sysfs_create_group(&data->kobj, &stats_attr_group);
 	if (ret)
-		goto error_out;
+		goto error_sysfs;
 
 	stat->cpu = cpu;
-	per_cpu(cpufreq_stats_table, cpu) = stat;
+	seqcount_init(&stat->seq);
 
 	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++) {
 		unsigned int freq = table[i].frequency;
@@ -267,17 +270,17 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 		j++;
 	}
 	stat->state_num = j;
-	spin_lock(&cpufreq_stats_lock);
 	stat->last_time = get_jiffies_64();
 	stat->last_index = freq_table_get_index(stat, policy->cur);
-	spin_unlock(&cpufreq_stats_lock);
+	rcu_assign_pointer(per_cpu(cpufreq_stats_table, cpu), stat);
 	cpufreq_cpu_put(data);
 	return 0;
 error_out:
+	sysfs_remove_group(&data->kobj, &stats_attr_group);
+error_sysfs:
 	cpufreq_cpu_put(data);
 error_get_fail:
 	kfree(stat);
-	per_cpu(cpufreq_stats_table, cpu) = NULL;
 	return ret;
 }
 
@@ -305,37 +308,172 @@ static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 	struct cpufreq_freqs *freq = data;
 	struct cpufreq_stats *stat;
 	int old_index, new_index;
+	u64 cur_time;
 
 	if (val != CPUFREQ_POSTCHANGE)
 		return 0;
 
-	cpufreq_stats_update(freq->cpu);
-
-	spin_lock(&cpufreq_stats_lock);
-	stat = per_cpu(cpufreq_stats_table, freq->cpu);
-	if (!stat) {
-		spin_unlock(&cpufreq_stats_lock);
-		return 0;
-	}
+	rcu_read_lock();
+	stat = rcu_dereference(per_cpu(cpufreq_stats_table, freq->cpu));
+	if (!stat)
+		goto out;
 
+	cur_time = get_jiffies_64();
 	old_index = stat->last_index;
 	new_index = freq_table_get_index(stat, freq->new);
 
-	if (old_index == new_index) {
-		spin_unlock(&cpufreq_stats_lock);
-		return 0;
+	write_seqcount_begin(&stat->seq);
+	if (old_index >= 0)
+		stat->time_in_state[old_index] =
+			cputime64_add(stat->time_in_state[old_index],
+				      cputime_sub(cur_time, stat->last_time));
+	stat->last_time = cur_time;
+
+	if (old_index != new_index) {
+		stat->last_index = new_index;
+#ifdef CONFIG_CPU_FREQ_STAT_DETAILS
+		if (old_index >= 0 && new_index >= 0)
+			stat->trans_table[old_index * stat->max_state +
+					  new_index]++;
+#endif
+		stat->total_trans++;
 	}
+	write_seqcount_end(&stat->seq);
+out:
+	rcu_read_unlock();
+	return 0;
+}
+
+/*
+ * Binary snapshot of every online cpu, meant to be read in one go from
+ * debugfs "cpufreq_stats". Native endian, times in usecs:
+ *
+ *	struct cpufreq_stats_bin_header
+ *	nr_cpus times:
+ *		struct cpufreq_stats_bin_cpu
+ *		state_num times struct cpufreq_stats_bin_state
+ *		with CPUFREQ_STATS_BIN_TRANS set in flags, state_num *
+ *		state_num u32 transition counts, row is from, column is to
+ */
+#define CPUFREQ_STATS_BIN_MAGIC		0x54534643	/* "CFST" */
+#define CPUFREQ_STATS_BIN_VERSION	1
+#define CPUFREQ_STATS_BIN_TRANS		0x1
+
+struct cpufreq_stats_bin_header {
+	u32 magic;
+	u16 version;
+	u16 nr_cpus;
+	u32 flags;
+	u32 reserved;
+};
+
+struct cpufreq_stats_bin_cpu {
+	u32 cpu;
+	u32 state_num;
+	s32 cur_index;
+	u32 total_trans;
+};
+
+struct cpufreq_stats_bin_state {
+	u32 freq;
+	u32 reserved;
+	u64 time_us;
+};
+
+static struct dentry *cpufreq_stats_debugfs;
+
+static int cpufreq_stats_bin_cpu(struct seq_file *m,
+				 struct cpufreq_stats *stat)
+{
+	struct cpufreq_stats_bin_cpu rec;
+	struct cpufreq_stats_bin_state *states;
+	size_t size, trans_size = 0;
+	unsigned seq;
+	u64 cur_time;
+	int i;
 
-	stat->last_index = new_index;
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
-	if (old_index >= 0 && new_index >= 0)
-		stat->trans_table[old_index * stat->max_state + new_index]++;
+	trans_size = stat->state_num * stat->state_num * sizeof(u32);
 #endif
-	stat->total_trans++;
-	spin_unlock(&cpufreq_stats_lock);
+	size = stat->state_num * sizeof(*states) + trans_size;
+	states = kzalloc(size, GFP_KERNEL);
+	if (!states)
+		return -ENOMEM;
+
+	do {
+		seq = read_seqcount_begin(&stat->seq);
+		cur_time = get_jiffies_64();
+		rec.cpu = stat->cpu;
+		rec.state_num = stat->state_num;
+		rec.cur_index = stat->last_index;
+		rec.total_trans = stat->total_trans;
+		for (i = 0; i < stat->state_num; i++) {
+			states[i].freq = stat->freq_table[i];
+			states[i].time_us = div_u64((u64)cpufreq_stats_time(
+					stat, i, cur_time) * USEC_PER_SEC, HZ);
+		}
+#ifdef CONFIG_CPU_FREQ_STAT_DETAILS
+		for (i = 0; i < stat->state_num; i++)
+			memcpy((u32 *)(states + stat->state_num) +
+			       i * stat->state_num,
+			       stat->trans_table + i * stat->max_state,
+			       stat->state_num * sizeof(u32));
+#endif
+	} while (read_seqcount_retry(&stat->seq, seq));
+
+	seq_write(m, &rec, sizeof(rec));
+	seq_write(m, states, size);
+	kfree(states);
 	return 0;
 }
 
+static int cpufreq_stats_bin_show(struct seq_file *m, void *unused)
+{
+	struct cpufreq_stats_bin_header hdr = {
+		.magic = CPUFREQ_STATS_BIN_MAGIC,
+		.version = CPUFREQ_STATS_BIN_VERSION,
+	};
+	struct cpufreq_stats *stat;
+	unsigned int cpu, nr;
+	int ret = 0;
+
+#ifdef CONFIG_CPU_FREQ_STAT_DETAILS
+	hdr.flags |= CPUFREQ_STATS_BIN_TRANS;
+#endif
+
+	/* tables are only freed once their cpu is dead */
+	get_online_cpus();
+	for_each_online_cpu(cpu)
+		if (per_cpu(cpufreq_stats_table, cpu))
+			hdr.nr_cpus++;
+	seq_write(m, &hdr, sizeof(hdr));
+
+	/* a table created since counting is left for the next read */
+	nr = hdr.nr_cpus;
+	for_each_online_cpu(cpu) {
+		stat = per_cpu(cpufreq_stats_table, cpu);
+		if (!stat || !nr--)
+			continue;
+		ret = cpufreq_stats_bin_cpu(m, stat);
+		if (ret)
+			break;
+	}
+	put_online_cpus();
+	return ret;
+}
+
+static int cpufreq_stats_bin_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cpufreq_stats_bin_show, NULL);
+}
+
+static const struct file_operations cpufreq_stats_bin_fops = {
+	.open		= cpufreq_stats_bin_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int cpufreq_stats_create_table_cpu(unsigned int cpu)
 {
 	struct cpufreq_policy *policy;
@@ -403,7 +541,6 @@ static int __init cpufreq_stats_init(void)
 	int ret;
 	unsigned int cpu;
 
-	spin_lock_init(&cpufreq_stats_lock);
 	ret = cpufreq_register_notifier(&notifier_policy_block,
 				CPUFREQ_POLICY_NOTIFIER);
 	if (ret)
@@ -421,6 +558,9 @@ static int __init cpufreq_stats_init(void)
 	for_each_online_cpu(cpu) {
 		cpufreq_update_policy(cpu);
 	}
+
+	cpufreq_stats_debugfs = debugfs_create_file("cpufreq_stats", 0444,
+				NULL, NULL, &cpufreq_stats_bin_fops);
 	return 0;
 }
 static void __exit cpufreq_stats_exit(void)
@@ -432,6 +572,7 @@ static void __exit cpufreq_stats_exit(void)
 	cpufreq_unregister_notifier(&notifier_trans_block,
 			CPUFREQ_TRANSITION_NOTIFIER);
 	unregister_hotcpu_notifier(&cpufreq_stat_cpu_notifier);
+	debugfs_remove(cpufreq_stats_debugfs);
 	for_each_online_cpu(cpu) {
 		cpufreq_stats_free_table(cpu);
 		cpufreq_stats_free_sysfs(cpu);
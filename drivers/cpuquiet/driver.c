@@ -22,25 +22,47 @@
 #include <linux/cpu.h>
 #include <linux/jiffies.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <asm/cputime.h>
 
 #include "cpuquiet.h"
 
+/* hotplug latency buckets, bucket n counts [2^(n-1), 2^n) usec */
+#define CPQ_LAT_BUCKETS	16
+
 struct cpuquiet_cpu_stat {
 	cputime64_t time_up_total;
 	u64 last_update;
 	unsigned int up_down_count;
+	unsigned int up_latency_hist[CPQ_LAT_BUCKETS];
+	unsigned int down_latency_hist[CPQ_LAT_BUCKETS];
+	ktime_t requested;
 	struct kobject cpu_kobject;
 };
 
 struct cpu_attribute {
 	struct attribute attr;
-	enum { up_down_count, time_up_total } type;
+	enum { up_down_count, time_up_total,
+		up_latency_hist, down_latency_hist } type;
 };
 
 static struct cpuquiet_driver *cpuquiet_curr_driver;
 struct cpuquiet_cpu_stat *stats;
 
+/*
+ * Transitions are serialized by cpuquiet_hotplug_lock. Batched requests
+ * are merged under request_lock and carried out by hotplug_work.
+ */
+static DEFINE_MUTEX(cpuquiet_hotplug_lock);
+static DEFINE_SPINLOCK(request_lock);
+static struct cpumask request_up;
+static struct cpumask request_down;
+static struct workqueue_struct *hotplug_wq;
+static struct work_struct hotplug_work;
+
 #define CPU_ATTRIBUTE(_name) \
 	static struct cpu_attribute _name ## _attr = {			\
 		.attr =  {.name = __stringify(_name), .mode = 0444 },	\
@@ -49,10 +71,14 @@ struct cpuquiet_cpu_stat *stats;
 
 CPU_ATTRIBUTE(up_down_count);
 CPU_ATTRIBUTE(time_up_total);
+CPU_ATTRIBUTE(up_latency_hist);
+CPU_ATTRIBUTE(down_latency_hist);
 
 static struct attribute *cpu_attributes[] = {
 	&up_down_count_attr.attr,
 	&time_up_total_attr.attr,
+	&up_latency_hist_attr.attr,
+	&down_latency_hist_attr.attr,
 	NULL,
 };
 
@@ -71,34 +97,171 @@ static void stats_update(struct cpuquiet_cpu_stat *stat, bool up)
 	stat->last_update = cur_jiffies;
 }
 
-int cpuquiet_quiesence_cpu(unsigned int cpunumber)
+/* account a completed transition requested at stat->requested */
+static void stats_latency(struct cpuquiet_cpu_stat *stat, bool up)
+{
+	s64 us = ktime_us_delta(ktime_get(), stat->requested);
+	unsigned int bucket = min_t(unsigned int, fls64(max_t(s64, us, 0)),
+					CPQ_LAT_BUCKETS - 1);
+
+	if (up)
+		stat->up_latency_hist[bucket]++;
+	else
+		stat->down_latency_hist[bucket]++;
+}
+
+static int quiesence_cpu_locked(unsigned int cpunumber)
 {
 	int err = -EPERM;
 
 	if (cpuquiet_curr_driver && cpuquiet_curr_driver->quiesence_cpu)
 		err = cpuquiet_curr_driver->quiesence_cpu(cpunumber);
 
-	if (!err)
+	if (!err) {
 		stats_update(stats + cpunumber, 0);
+		stats_latency(stats + cpunumber, 0);
+	}
 
 	return err;
 }
-EXPORT_SYMBOL(cpuquiet_quiesence_cpu);
 
-int cpuquiet_wake_cpu(unsigned int cpunumber)
+static int wake_cpu_locked(unsigned int cpunumber)
 {
 	int err = -EPERM;
 
 	if (cpuquiet_curr_driver && cpuquiet_curr_driver->wake_cpu)
 		err = cpuquiet_curr_driver->wake_cpu(cpunumber);
 
-	if (!err)
+	if (!err) {
 		stats_update(stats + cpunumber, 1);
+		stats_latency(stats + cpunumber, 1);
+	}
+
+	return err;
+}
+
+int cpuquiet_quiesence_cpu(unsigned int cpunumber)
+{
+	int err;
+
+	mutex_lock(&cpuquiet_hotplug_lock);
+	stats[cpunumber].requested = ktime_get();
+	err = quiesence_cpu_locked(cpunumber);
+	mutex_unlock(&cpuquiet_hotplug_lock);
+
+	return err;
+}
+EXPORT_SYMBOL(cpuquiet_quiesence_cpu);
+
+int cpuquiet_wake_cpu(unsigned int cpunumber)
+{
+	int err;
+
+	mutex_lock(&cpuquiet_hotplug_lock);
+	stats[cpunumber].requested = ktime_get();
+	err = wake_cpu_locked(cpunumber);
+	mutex_unlock(&cpuquiet_hotplug_lock);
 
 	return err;
 }
 EXPORT_SYMBOL(cpuquiet_wake_cpu);
 
+static void hotplug_work_func(struct work_struct *work)
+{
+	struct cpumask up, down;
+	unsigned long flags;
+	unsigned int cpu;
+	int err;
+
+	mutex_lock(&cpuquiet_hotplug_lock);
+
+	spin_lock_irqsave(&request_lock, flags);
+	cpumask_andnot(&up, &request_up, cpu_online_mask);
+	cpumask_and(&down, &request_down, cpu_online_mask);
+	cpumask_clear(&request_up);
+	cpumask_clear(&request_down);
+	spin_unlock_irqrestore(&request_lock, flags);
+
+	if (!cpuquiet_curr_driver)
+		goto out;
+
+	if (cpuquiet_curr_driver->update_cpus) {
+		err = cpuquiet_curr_driver->update_cpus(&up, &down);
+		if (err)
+			pr_debug("%s: %s update_cpus: %d\n", __func__,
+				cpuquiet_curr_driver->name, err);
+
+		/* the driver may have done part of the batch */
+		for_each_cpu(cpu, &up)
+			if (cpu_online(cpu)) {
+				stats_update(stats + cpu, 1);
+				stats_latency(stats + cpu, 1);
+			}
+		for_each_cpu(cpu, &down)
+			if (!cpu_online(cpu)) {
+				stats_update(stats + cpu, 0);
+				stats_latency(stats + cpu, 0);
+			}
+	} else {
+		/* bring cores up before taking others down */
+		for_each_cpu(cpu, &up)
+			wake_cpu_locked(cpu);
+		for_each_cpu(cpu, &down)
+			quiesence_cpu_locked(cpu);
+	}
+
+out:
+	mutex_unlock(&cpuquiet_hotplug_lock);
+}
+
+/*
+ * Queue cpus in up to be woken and cpus in down to be quiesced. Either
+ * mask may be NULL. Requests are merged with ones still pending, the
+ * latest one for a cpu wins, and carried out asynchronously as a single
+ * batch. Returns 0 once queued.
+ */
+int cpuquiet_request_cpus(const struct cpumask *up, const struct cpumask *down)
+{
+	ktime_t now = ktime_get();
+	unsigned long flags;
+	unsigned int cpu;
+
+	if (!cpuquiet_curr_driver || !hotplug_wq)
+		return -EPERM;
+
+	spin_lock_irqsave(&request_lock, flags);
+	if (up) {
+		for_each_cpu(cpu, up) {
+			if (!cpumask_test_cpu(cpu, &request_up))
+				stats[cpu].requested = now;
+			cpumask_set_cpu(cpu, &request_up);
+			cpumask_clear_cpu(cpu, &request_down);
+		}
+	}
+	if (down) {
+		for_each_cpu(cpu, down) {
+			if (!cpumask_test_cpu(cpu, &request_down))
+				stats[cpu].requested = now;
+			cpumask_set_cpu(cpu, &request_down);
+			cpumask_clear_cpu(cpu, &request_up);
+		}
+	}
+	spin_unlock_irqrestore(&request_lock, flags);
+
+	queue_work(hotplug_wq, &hotplug_work);
+
+	return 0;
+}
+EXPORT_SYMBOL(cpuquiet_request_cpus);
+
+/* wait for queued requests to be carried out */
+void cpuquiet_flush_requests(void)
+{
+	if (hotplug_wq)
+		flush_workqueue(hotplug_wq);
+}
+EXPORT_SYMBOL(cpuquiet_flush_requests);
+
 static ssize_t stats_sysfs_show(struct kobject *kobj,
 			struct attribute *attr, char *buf)
 {
@@ -108,6 +271,8 @@ static ssize_t stats_sysfs_show(struct kobject *kobj,
 		container_of(kobj, struct cpuquiet_cpu_stat, cpu_kobject);
 	ssize_t len = 0;
 	bool was_up = stat->up_down_count & 0x1;
+	unsigned int *hist = NULL;
+	int i;
 
 	stats_update(stat, was_up);
 
@@ -118,6 +283,19 @@ static ssize_t stats_sysfs_show(struct kobject *kobj,
 	case time_up_total:
 		len =  sprintf(buf, "%llu\n", stat->time_up_total);
 		break;
+	case up_latency_hist:
+		hist = stat->up_latency_hist;
+		break;
+	case down_latency_hist:
+		hist = stat->down_latency_hist;
+		break;
+	}
+
+	if (hist) {
+		for (i = 0; i < CPQ_LAT_BUCKETS; i++)
+			len += sprintf(buf + len, "%s%u", i ? " " : "",
+					hist[i]);
+		len += sprintf(buf + len, "\n");
 	}
 
 	return len;
@@ -134,7 +312,7 @@ static struct kobj_type ktype_cpu_stats = {
 
 int cpuquiet_register_driver(struct cpuquiet_driver *drv)
 {
-	int err = -EBUSY;
+	int err = 0;
 	unsigned int cpu;
 	struct sys_device *sys_dev;
 	u64 cur_jiffies;
@@ -142,9 +320,28 @@ int cpuquiet_register_driver(struct cpuquiet_driver *drv)
 	if (!drv)
 		return -EINVAL;
 
+	/* claim the driver slot before touching the current driver's state */
+	mutex_lock(&cpuquiet_lock);
+	if (cpuquiet_curr_driver) {
+		err = -EBUSY;
+		goto out;
+	}
+
 	stats = kzalloc(nr_cpu_ids * sizeof(*stats), GFP_KERNEL);
-	if (!stats)
-		return -ENOMEM;
+	if (!stats) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	hotplug_wq = alloc_workqueue("cpuquiet-hotplug",
+			WQ_UNBOUND | WQ_RESCUER | WQ_FREEZABLE, 1);
+	if (!hotplug_wq) {
+		kfree(stats);
+		stats = NULL;
+		err = -ENOMEM;
+		goto out;
+	}
+	INIT_WORK(&hotplug_work, hotplug_work_func);
 
 	for_each_possible_cpu(cpu) {
 		cur_jiffies = get_jiffies_64();
@@ -159,12 +356,9 @@ int cpuquiet_register_driver(struct cpuquiet_driver *drv)
 		}
 	}
 
-	mutex_lock(&cpuquiet_lock);
-	if (!cpuquiet_curr_driver) {
-		err = 0;
-		cpuquiet_curr_driver = drv;
-		cpuquiet_switch_governor(cpuquiet_get_first_governor());
-	}
+	cpuquiet_curr_driver = drv;
+	cpuquiet_switch_governor(cpuquiet_get_first_governor());
+out:
 	mutex_unlock(&cpuquiet_lock);
 
 	return err;
@@ -188,9 +382,13 @@ void cpuquiet_unregister_driver(struct cpuquiet_driver *drv)
 
 	/* stop current governor first */
 	cpuquiet_switch_governor(NULL);
+	destroy_workqueue(hotplug_wq);
+	hotplug_wq = NULL;
 
 	mutex_lock(&cpuquiet_lock);
+	mutex_lock(&cpuquiet_hotplug_lock);
 	cpuquiet_curr_driver = NULL;
+	mutex_unlock(&cpuquiet_hotplug_lock);
 
 	for_each_possible_cpu(cpu) {
 		kobject_put(&stats[cpu].cpu_kobject);
@@ -53,6 +53,8 @@ int cpuquiet_switch_governor(struct cpuquiet_governor *gov)
 	if (cpuquiet_curr_governor) {
 		if (cpuquiet_curr_governor->stop)
 			cpuquiet_curr_governor->stop();
+		/* let the old governor's requests land before the new starts */
+		cpuquiet_flush_requests();
 		module_put(cpuquiet_curr_governor->owner);
 	}
 
@@ -292,9 +292,9 @@ static void balanced_work_func(struct work_struct *work)
 		last_change_time = now;
 #endif
 		if (up)
-			cpuquiet_wake_cpu(cpu);
+			cpuquiet_request_cpus(cpumask_of(cpu), NULL);
 		else
-			cpuquiet_quiesence_cpu(cpu);
+			cpuquiet_request_cpus(NULL, cpumask_of(cpu));
 	}
 }
 
@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * The predictive governor keeps the last HISTORY_LEN samples of
+ * avg_nr_running(). Cores are brought up as soon as the runnable-thread
+ * count, extrapolated one sample ahead along its rising trend, needs
+ * them, and taken down only once every sample of the last down_samples
+ * needed fewer. Touch input pre-onlines input_boost_cpus cores and holds
+ * them for input_boost_ms.
+ *
+ * Transitions are queued with cpuquiet_request_cpus(), so up_latency_us,
+ * up_latency_max_us and down_latency_us run from the observed demand to
+ * the queued request only. The time until the core is actually up or down
+ * is in up_latency_hist and down_latency_hist of the cpu's stats.
+ */
+
+#include <linux/kernel.h>
+#include <linux/cpuquiet.h>
+#include <linux/cpumask.h>
+#include <linux/module.h>
+#include <linux/pm_qos_params.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/input.h>
+
+typedef enum {
+	DISABLED,
+	ENABLED,
+} PREDICTIVE_STATE;
+
+#define HISTORY_LEN	8
+
+#define NR_FSHIFT_EXP	3
+#define NR_FSHIFT	(1 << NR_FSHIFT_EXP)
+
+static struct delayed_work predictive_work;
+static struct work_struct predictive_input_work;
+static struct kobject *predictive_kobject;
+static struct workqueue_struct *predictive_wq;
+static PREDICTIVE_STATE predictive_state;
+
+/* configurable parameters */
+static unsigned int sample_rate = 20;		/* msec */
+static unsigned int down_samples = 4;
+static unsigned int nr_run_slack = 1;		/* 1 / 8 thread */
+static unsigned int input_boost_cpus = 2;
+static unsigned int input_boost_ms = 200;	/* msec */
+
+/* statistics */
+static unsigned long predictions;
+static unsigned long mispredict_under;
+static unsigned long mispredict_over;
+static unsigned long input_boosts;
+static unsigned long up_latency_us;
+static unsigned long up_latency_max_us;
+static unsigned long down_latency_us;
+
+static unsigned long history[HISTORY_LEN];
+static unsigned int history_next;
+static unsigned int history_count;
+static unsigned int predicted_cpus;
+
+static unsigned long boost_until;
+static ktime_t input_time;
+static bool input_handler_registered;
+
+DEFINE_MUTEX(predictive_work_lock);
+
+static unsigned long history_at(unsigned int age)
+{
+	return history[(history_next + HISTORY_LEN - 1 - age) % HISTORY_LEN];
+}
+
+/* cores needed to run nr (FSHIFT fixed point) threads */
+static unsigned int cpus_needed(unsigned long nr)
+{
+	unsigned long slack = nr_run_slack << (FSHIFT - NR_FSHIFT_EXP);
+	unsigned int n = 1;
+
+	if (nr > slack)
+		n = DIV_ROUND_UP(nr - slack, FIXED_1);
+	return clamp_t(unsigned int, n, 1, nr_cpu_ids);
+}
+
+/*
+ * Runnable threads one sample ahead: the latest sample plus the mean
+ * slope over the history when it is rising, the latest sample otherwise.
+ */
+static unsigned long predict_nr_running(void)
+{
+	unsigned int n = min_t(unsigned int, history_count, HISTORY_LEN);
+	unsigned long last = history_at(0);
+	unsigned long first = history_at(n - 1);
+
+	if (n < 2 || last <= first)
+		return last;
+	return last + (last - first) / (n - 1);
+}
+
+static unsigned int get_lightest_loaded_cpu_n(void)
+{
+	unsigned long min_avg_runnables = ULONG_MAX;
+	unsigned int cpu = nr_cpu_ids;
+	int i;
+
+	for_each_online_cpu(i) {
+		unsigned int nr_runnables = get_avg_nr_running(i);
+
+		if (i > 0 && min_avg_runnables > nr_runnables) {
+			cpu = i;
+			min_avg_runnables = nr_runnables;
+		}
+	}
+
+	return cpu;
+}
+
+/*
+ * Bring the number of online cores to what is predicted or held by the
+ * history. All cores needed are queued to the driver as one batch.
+ * trigger is when the demand was observed; the latencies kept here end
+ * when the request is queued, the driver accounts for the transition.
+ */
+static void predictive_apply(unsigned int want, ktime_t trigger)
+{
+	int max_cpus = pm_qos_request(PM_QOS_MAX_ONLINE_CPUS) ? : 4;
+	int min_cpus = pm_qos_request(PM_QOS_MIN_ONLINE_CPUS);
+	unsigned int nr_cpus = num_online_cpus();
+	struct cpumask up;
+	unsigned int cpu;
+	unsigned long us;
+
+	if (time_before(jiffies, boost_until))
+		want = max(want, input_boost_cpus);
+	want = clamp_t(int, want, max(min_cpus, 1), max_cpus);
+
+	if (want > nr_cpus) {
+		cpumask_clear(&up);
+		for_each_cpu_not(cpu, cpu_online_mask) {
+			if (cpu >= nr_cpu_ids || nr_cpus >= want)
+				break;
+			cpumask_set_cpu(cpu, &up);
+			nr_cpus++;
+		}
+		if (cpumask_empty(&up) || cpuquiet_request_cpus(&up, NULL))
+			return;
+		us = ktime_us_delta(ktime_get(), trigger);
+		up_latency_us = us;
+		if (us > up_latency_max_us)
+			up_latency_max_us = us;
+	} else if (want < nr_cpus) {
+		/* one at a time, the history keeps us from dropping fast */
+		cpu = get_lightest_loaded_cpu_n();
+		if (cpu < nr_cpu_ids &&
+		    !cpuquiet_request_cpus(NULL, cpumask_of(cpu)))
+			down_latency_us = ktime_us_delta(ktime_get(), trigger);
+	}
+}
+
+static void predictive_sample(void)
+{
+	ktime_t now = ktime_get();
+	unsigned int actual, want, i, n;
+
+	history[history_next] = avg_nr_running();
+	history_next = (history_next + 1) % HISTORY_LEN;
+	history_count++;
+
+	actual = cpus_needed(history_at(0));
+	if (predicted_cpus) {
+		predictions++;
+		if (actual > predicted_cpus)
+			mispredict_under++;
+		else if (actual < predicted_cpus)
+			mispredict_over++;
+	}
+	predicted_cpus = cpus_needed(predict_nr_running());
+
+	want = predicted_cpus;
+	n = min3(down_samples, history_count, (unsigned int)HISTORY_LEN);
+	for (i = 0; i < n; i++)
+		want = max(want, cpus_needed(history_at(i)));
+
+	predictive_apply(want, now);
+}
+
+static void predictive_work_func(struct work_struct *work)
+{
+	mutex_lock(&predictive_work_lock);
+
+	if (predictive_state == ENABLED) {
+		predictive_sample();
+		queue_delayed_work(predictive_wq, &predictive_work,
+					msecs_to_jiffies(sample_rate));
+	}
+
+	mutex_unlock(&predictive_work_lock);
+}
+
+static void predictive_input_work_func(struct work_struct *work)
+{
+	mutex_lock(&predictive_work_lock);
+
+	if (predictive_state == ENABLED)
+		predictive_apply(predicted_cpus, input_time);
+
+	mutex_unlock(&predictive_work_lock);
+}
+
+static void predictive_input_event(struct input_handle *handle,
+				   unsigned int type,
+				   unsigned int code, int value)
+{
+	if (!input_boost_cpus || type != EV_SYN || code != SYN_REPORT)
+		return;
+
+	/* one boost per window, the sampler handles the rest */
+	if (time_before(jiffies, boost_until))
+		return;
+	boost_until = jiffies + msecs_to_jiffies(input_boost_ms);
+	if (num_online_cpus() < input_boost_cpus) {
+		input_boosts++;
+		input_time = ktime_get();
+		queue_work(predictive_wq, &predictive_input_work);
+	}
+}
+
+struct predictive_input {
+	struct input_handle handle;
+	struct work_struct open_work;
+};
+
+static void predictive_input_open(struct work_struct *w)
+{
+	struct predictive_input *pi =
+		container_of(w, struct predictive_input, open_work);
+	int error;
+
+	error = input_open_device(&pi->handle);
+	if (error) {
+		input_unregister_handle(&pi->handle);
+		kfree(pi);
+	}
+}
+
+static int predictive_input_connect(struct input_handler *handler,
+				    struct input_dev *dev,
+				    const struct input_device_id *id)
+{
+	struct predictive_input *pi;
+	int error;
+
+	pi = kzalloc(sizeof(*pi), GFP_KERNEL);
+	if (!pi)
+		return -ENOMEM;
+
+	pi->handle.dev = dev;
+	pi->handle.handler = handler;
+	pi->handle.name = "cpuquiet_predictive";
+
+	error = input_register_handle(&pi->handle);
+	if (error) {
+		kfree(pi);
+		return error;
+	}
+
+	INIT_WORK(&pi->open_work, predictive_input_open);
+	queue_work(predictive_wq, &pi->open_work);
+	return 0;
+}
+
+static void predictive_input_disconnect(struct input_handle *handle)
+{
+	struct predictive_input *pi =
+		container_of(handle, struct predictive_input, handle);
+
+	cancel_work_sync(&pi->open_work);
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(pi);
+}
+
+static const struct input_device_id predictive_ids[] = {
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) |
+			    BIT_MASK(ABS_MT_POSITION_Y) },
+	}, /* multi-touch touchscreen */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] =
+			    BIT_MASK(ABS_X) | BIT_MASK(ABS_Y) },
+	}, /* touchpad */
+	{ },
+};
+
+static struct input_handler predictive_input_handler = {
+	.event          = predictive_input_event,
+	.connect        = predictive_input_connect,
+	.disconnect     = predictive_input_disconnect,
+	.name           = "cpuquiet_predictive",
+	.id_table       = predictive_ids,
+};
+
+CPQ_BASIC_ATTRIBUTE(sample_rate, 0644, uint);
+CPQ_BASIC_ATTRIBUTE(down_samples, 0644, uint);
+CPQ_BASIC_ATTRIBUTE(nr_run_slack, 0644, uint);
+CPQ_BASIC_ATTRIBUTE(input_boost_cpus, 0644, uint);
+CPQ_BASIC_ATTRIBUTE(input_boost_ms, 0644, uint);
+CPQ_BASIC_ATTRIBUTE(predictions, 0444, ulong);
+CPQ_BASIC_ATTRIBUTE(mispredict_under, 0444, ulong);
+CPQ_BASIC_ATTRIBUTE(mispredict_over, 0444, ulong);
+CPQ_BASIC_ATTRIBUTE(input_boosts, 0444, ulong);
+CPQ_BASIC_ATTRIBUTE(up_latency_us, 0444, ulong);
+CPQ_BASIC_ATTRIBUTE(up_latency_max_us, 0444, ulong);
+CPQ_BASIC_ATTRIBUTE(down_latency_us, 0444, ulong);
+
+static struct attribute *predictive_attributes[] = {
+	&sample_rate_attr.attr,
+	&down_samples_attr.attr,
+	&nr_run_slack_attr.attr,
+	&input_boost_cpus_attr.attr,
+	&input_boost_ms_attr.attr,
+	&predictions_attr.attr,
+	&mispredict_under_attr.attr,
+	&mispredict_over_attr.attr,
+	&input_boosts_attr.attr,
+	&up_latency_us_attr.attr,
+	&up_latency_max_us_attr.attr,
+	&down_latency_us_attr.attr,
+	NULL,
+};
+
+static const struct sysfs_ops predictive_sysfs_ops = {
+	.show = cpuquiet_auto_sysfs_show,
+	.store = cpuquiet_auto_sysfs_store,
+};
+
+static struct kobj_type ktype_predictive = {
+	.sysfs_ops = &predictive_sysfs_ops,
+	.default_attrs = predictive_attributes,
+};
+
+static int predictive_sysfs(void)
+{
+	int err;
+
+	predictive_kobject = kzalloc(sizeof(*predictive_kobject),
+				GFP_KERNEL);
+
+	if (!predictive_kobject)
+		return -ENOMEM;
+
+	err = cpuquiet_kobject_init(predictive_kobject, &ktype_predictive,
+				"predictive");
+
+	if (err)
+		kfree(predictive_kobject);
+
+	return err;
+}
+
+static void predictive_device_busy(void)
+{
+	if (predictive_state != DISABLED) {
+		predictive_state = DISABLED;
+		cancel_delayed_work_sync(&predictive_work);
+		cancel_work_sync(&predictive_input_work);
+	}
+}
+
+static void predictive_device_free(void)
+{
+	if (predictive_state == DISABLED) {
+		predictive_state = ENABLED;
+		predictive_work_func(NULL);
+	}
+}
+
+static void predictive_stop(void)
+{
+	if (input_handler_registered)
+		input_unregister_handler(&predictive_input_handler);
+	input_handler_registered = false;
+	predictive_state = DISABLED;
+	cancel_delayed_work_sync(&predictive_work);
+	cancel_work_sync(&predictive_input_work);
+	destroy_workqueue(predictive_wq);
+	kobject_put(predictive_kobject);
+}
+
+static int predictive_start(void)
+{
+	int err;
+
+	err = predictive_sysfs();
+	if (err)
+		return err;
+
+	predictive_wq = alloc_workqueue("cpuquiet-predictive",
+			WQ_UNBOUND | WQ_RESCUER | WQ_FREEZABLE, 1);
+	if (!predictive_wq) {
+		kobject_put(predictive_kobject);
+		return -ENOMEM;
+	}
+
+	INIT_DELAYED_WORK(&predictive_work, predictive_work_func);
+	INIT_WORK(&predictive_input_work, predictive_input_work_func);
+
+	history_next = 0;
+	history_count = 0;
+	predicted_cpus = 0;
+	boost_until = jiffies;
+
+	/* run without input boost rather than not at all */
+	input_handler_registered =
+		!input_register_handler(&predictive_input_handler);
+	if (!input_handler_registered)
+		pr_warn("%s: failed to register input handler\n", __func__);
+
+	predictive_state = ENABLED;
+	predictive_work_func(NULL);
+
+	return 0;
+}
+
+struct cpuquiet_governor predictive_governor = {
+	.name			  = "predictive",
+	.start			  = predictive_start,
+	.device_free_notification = predictive_device_free,
+	.device_busy_notification = predictive_device_busy,
+	.stop			  = predictive_stop,
+	.owner			  = THIS_MODULE,
+};
+
+static int __init init_predictive(void)
+{
+	return cpuquiet_register_governor(&predictive_governor);
+}
+
+static void __exit exit_predictive(void)
+{
+	cpuquiet_unregister_governor(&predictive_governor);
+}
+
+MODULE_LICENSE("GPL");
+module_init(init_predictive);
+module_exit(exit_predictive);
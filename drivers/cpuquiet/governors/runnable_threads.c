@@ -140,9 +140,9 @@ static void runnables_work_func(struct work_struct *work)
 
 	if (cpu < nr_cpu_ids) {
 		if (up)
-			cpuquiet_wake_cpu(cpu);
+			cpuquiet_request_cpus(cpumask_of(cpu), NULL);
 		else
-			cpuquiet_quiesence_cpu(cpu);
+			cpuquiet_request_cpus(NULL, cpumask_of(cpu));
 	}
 
 	mutex_unlock(&runnables_work_lock);
@@ -23,7 +23,9 @@
 #include <linux/miscdevice.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
+#include <linux/seqlock.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/time.h>
 #include "logger.h"
 
@@ -33,17 +35,26 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Writers reserve space for an entry under the spinlock 'lock', which only
+ * covers moving the positions and writing a pending header. The payload is
+ * copied in and the entry committed without holding any lock. Readers never
+ * take 'lock': they snapshot the positions through the seqcount 'seq' and
+ * check after copying an entry out that no writer has reclaimed it meanwhile.
+ *
+ * Positions are byte counts since boot, so they never wrap and a reader that
+ * was lapped by the writers can tell. logger_offset() maps them into 'buffer'.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	spinlock_t		lock;	/* serializes reservations */
+	seqcount_t		seq;	/* w_pos, tail and head */
+	u64			w_pos;	/* next entry is reserved here */
+	u64			tail;	/* oldest entry not yet reclaimed */
+	u64			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
 };
 
@@ -51,18 +62,47 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by 'mutex'.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes readers of this file */
+	u64			r_pos;	/* current read position */
 	bool			r_all;	/* reader can read all entries */
 	int			r_ver;	/* reader ABI version */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
-#define logger_offset(n)	((n) & (log->size - 1))
+#define logger_offset(n)	((size_t)(n) & (log->size - 1))
+
+/*
+ * Entries are padded to this alignment in the ring, so that the first word of
+ * a header never wraps and its hdr_size can be updated atomically.
+ */
+#define LOGGER_ENTRY_ALIGN	sizeof(u32)
+
+/*
+ * Values of hdr_size for entries that are not committed. A writer reserves an
+ * entry as LOGGER_ENTRY_PENDING and commits it by setting hdr_size to
+ * sizeof(struct logger_entry), or to LOGGER_ENTRY_DISCARDED if copying the
+ * payload from userspace failed. Readers stop at pending entries and skip
+ * discarded ones; neither is ever returned to userspace.
+ */
+#define LOGGER_ENTRY_PENDING	0
+#define LOGGER_ENTRY_DISCARDED	1
+
+/* logger_entry_size - space taken in the ring by an entry of payload 'len' */
+static inline size_t logger_entry_size(size_t len)
+{
+	return ALIGN(sizeof(struct logger_entry) + len, LOGGER_ENTRY_ALIGN);
+}
+
+/* the hdr_size field of the entry at 'pos', see LOGGER_ENTRY_ALIGN */
+static inline __u16 *logger_entry_state(struct logger_log *log, u64 pos)
+{
+	return (__u16 *)(log->buffer + logger_offset(pos +
+		offsetof(struct logger_entry, hdr_size)));
+}
 
 /*
  * file_get_log - Given a file structure, return the associated log
@@ -88,39 +128,53 @@ static inline struct logger_log *file_get_log(struct file *file)
 }
 
 /*
- * get_entry_header - returns a pointer to the logger_entry header within
- * 'log' starting at offset 'off'. A temporary logger_entry 'scratch' must
- * be provided. Typically the return value will be a pointer within
- * 'logger->buf'.  However, a pointer to 'scratch' may be returned if
- * the log entry spans the end and beginning of the circular buffer.
+ * logger_get_pos - takes a consistent snapshot of the positions of 'log'.
+ * Any of the output pointers may be NULL.
  */
-static struct logger_entry *get_entry_header(struct logger_log *log,
-		size_t off, struct logger_entry *scratch)
+static void logger_get_pos(struct logger_log *log, u64 *w_pos, u64 *tail,
+			   u64 *head)
 {
-	size_t len = min(sizeof(struct logger_entry), log->size - off);
-	if (len != sizeof(struct logger_entry)) {
-		memcpy(((void *) scratch), log->buffer + off, len);
-		memcpy(((void *) scratch) + len, log->buffer,
-			sizeof(struct logger_entry) - len);
-		return scratch;
-	}
+	unsigned seq;
 
-	return (struct logger_entry *) (log->buffer + off);
+	do {
+		seq = read_seqcount_begin(&log->seq);
+		if (w_pos)
+			*w_pos = log->w_pos;
+		if (tail)
+			*tail = log->tail;
+		if (head)
+			*head = log->head;
+	} while (read_seqcount_retry(&log->seq, seq));
 }
 
 /*
- * get_entry_msg_len - Grabs the length of the message of the entry
- * starting from from 'off'.
- *
- * Caller needs to hold log->mutex.
+ * logger_reclaimed - whether the writers may have reused the space of the
+ * entry at 'pos'. Checked by readers after copying an entry out, which must
+ * be ordered before by smp_rmb().
+ */
+static inline bool logger_reclaimed(struct logger_log *log, u64 pos)
+{
+	u64 tail;
+
+	logger_get_pos(log, NULL, &tail, NULL);
+	return pos < tail;
+}
+
+/*
+ * get_entry_header - copies the logger_entry header within 'log' starting at
+ * position 'pos' into 'hdr', handling entries that span the end and beginning
+ * of the circular buffer.
  */
-static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
+static void get_entry_header(struct logger_log *log, u64 pos,
+			     struct logger_entry *hdr)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
+	size_t off = logger_offset(pos);
+	size_t len = min(sizeof(struct logger_entry), log->size - off);
 
-	entry = get_entry_header(log, off, &scratch);
-	return entry->len;
+	memcpy(hdr, log->buffer + off, len);
+	if (len != sizeof(struct logger_entry))
+		memcpy(((void *) hdr) + len, log->buffer,
+			sizeof(struct logger_entry) - len);
 }
 
 static size_t get_user_hdr_len(int ver)
@@ -156,18 +210,59 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * get_next_entry - finds the next entry 'reader' may read, skipping
+ * discarded entries and, unless the reader has r_all set, entries written by
+ * other uids. Returns true and fills in 'hdr' if there is one, false if the
+ * reader has caught up with the committed entries.
+ *
+ * Caller must hold reader->mutex.
+ */
+static bool get_next_entry(struct logger_log *log,
+			   struct logger_reader *reader,
+			   struct logger_entry *hdr)
+{
+	u64 w_pos, head;
+	__u16 state;
+
+	while (1) {
+		/* pull the reader forward if it was lapped or flushed */
+		logger_get_pos(log, &w_pos, NULL, &head);
+		if (reader->r_pos < head)
+			reader->r_pos = head;
+		if (reader->r_pos == w_pos)
+			return false;
+
+		state = ACCESS_ONCE(*logger_entry_state(log, reader->r_pos));
+		smp_rmb();
+		get_entry_header(log, reader->r_pos, hdr);
+		smp_rmb();
+		if (logger_reclaimed(log, reader->r_pos))
+			continue;
+
+		if (state == LOGGER_ENTRY_PENDING)
+			return false;
+		if (state != LOGGER_ENTRY_DISCARDED &&
+		    (reader->r_all || hdr->euid == current_euid()))
+			return true;
+
+		reader->r_pos += logger_entry_size(hdr->len);
+	}
+}
+
+/*
+ * do_read_log_to_user - reads the entry with header 'hdr' at the reader's
+ * position from 'log' into the user-space buffer 'buf', 'count' bytes in
+ * total. Returns 'count' on success, or -EAGAIN if the entry was reclaimed
+ * by the writers while it was being copied.
  *
- * Caller must hold log->mutex.
+ * Caller must hold reader->mutex.
  */
 static ssize_t do_read_log_to_user(struct logger_log *log,
 				   struct logger_reader *reader,
+				   struct logger_entry *hdr,
 				   char __user *buf,
 				   size_t count)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
 	size_t len;
 	size_t msg_start;
 
@@ -175,13 +270,12 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * First, copy the header to userspace, using the version of
 	 * the header requested
 	 */
-	entry = get_entry_header(log, reader->r_off, &scratch);
-	if (copy_header_to_user(reader->r_ver, entry, buf))
+	if (copy_header_to_user(reader->r_ver, hdr, buf))
 		return -EFAULT;
 
 	count -= get_user_hdr_len(reader->r_ver);
 	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(reader->r_off + sizeof(struct logger_entry));
+	msg_start = logger_offset(reader->r_pos + sizeof(struct logger_entry));
 
 	/*
 	 * We read from the msg in two disjoint operations. First, we read from
@@ -200,34 +294,27 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off +
-		sizeof(struct logger_entry) + count);
+	/* a writer lapped us while we were copying, try again */
+	smp_rmb();
+	if (logger_reclaimed(log, reader->r_pos))
+		return -EAGAIN;
+
+	reader->r_pos += logger_entry_size(hdr->len);
 
 	return count + get_user_hdr_len(reader->r_ver);
 }
 
-/*
- * get_next_entry_by_uid - Starting at 'off', returns an offset into
- * 'log->buffer' which contains the first entry readable by 'euid'
- */
-static size_t get_next_entry_by_uid(struct logger_log *log,
-		size_t off, uid_t euid)
+/* logger_readable - whether 'reader' has an entry to read */
+static bool logger_readable(struct logger_reader *reader)
 {
-	while (off != log->w_off) {
-		struct logger_entry *entry;
-		struct logger_entry scratch;
-		size_t next_len;
+	struct logger_entry hdr;
+	bool ret;
 
-		entry = get_entry_header(log, off, &scratch);
-
-		if (entry->euid == euid)
-			return off;
-
-		next_len = sizeof(struct logger_entry) + entry->len;
-		off = logger_offset(off + next_len);
-	}
+	mutex_lock(&reader->mutex);
+	ret = get_next_entry(reader->log, reader, &hdr);
+	mutex_unlock(&reader->mutex);
 
-	return off;
+	return ret;
 }
 
 /*
@@ -247,6 +334,7 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	struct logger_entry hdr;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -254,9 +342,7 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		ret = !logger_readable(reader);
 		if (!ret)
 			break;
 
@@ -277,136 +363,117 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
-
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
+	mutex_lock(&reader->mutex);
 
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	if (unlikely(!get_next_entry(log, reader, &hdr))) {
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
+	ret = get_user_hdr_len(reader->r_ver) + hdr.len;
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
 	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	ret = do_read_log_to_user(log, reader, &hdr, buf, ret);
+	if (unlikely(ret == -EAGAIN)) {
+		mutex_unlock(&reader->mutex);
+		goto start;
+	}
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at position 'pos'
  *
- * Caller must hold log->mutex.
+ * The caller must own the range, by holding log->lock or by having reserved
+ * it.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void do_write_log(struct logger_log *log, u64 pos, const void *buf,
+			 size_t count)
 {
-	size_t count = 0;
-
-	do {
-		size_t nr = sizeof(struct logger_entry) +
-			get_entry_msg_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
-
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
-	}
-
-	return 0;
-}
-
-/*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
- */
-static void fix_up_readers(struct logger_log *log, size_t len)
-{
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
+	size_t off = logger_offset(pos);
+	size_t len;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	if (count != len)
+		memcpy(log->buffer, buf + len, count - len);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * logger_reserve - reserves 'len' bytes for a new entry at the write position
+ * and writes its header there with hdr_size LOGGER_ENTRY_PENDING. The oldest
+ * entries are reclaimed to make room, which fails with -EAGAIN if one of them
+ * is still being written. Returns the position of the new entry in 'pos', or
+ * that of the entry still being written on -EAGAIN.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static int logger_reserve(struct logger_log *log, struct logger_entry *hdr,
+			  size_t len, u64 *pos)
 {
-	size_t len;
+	u64 tail = log->tail;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	while (log->w_pos + len - tail > log->size) {
+		struct logger_entry old;
 
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
+		get_entry_header(log, tail, &old);
+		if (old.hdr_size == LOGGER_ENTRY_PENDING) {
+			*pos = tail;
+			return -EAGAIN;
+		}
+		tail += logger_entry_size(old.len);
+	}
 
-	log->w_off = logger_offset(log->w_off + count);
+	/*
+	 * Readers copying out a reclaimed entry notice the new tail after
+	 * the copy, and the new header is not visible until w_pos moves.
+	 */
+	write_seqcount_begin(&log->seq);
+	log->tail = tail;
+	if (log->head < tail)
+		log->head = tail;
+	*pos = log->w_pos;
+	hdr->hdr_size = LOGGER_ENTRY_PENDING;
+	do_write_log(log, *pos, hdr, sizeof(struct logger_entry));
+	log->w_pos += len;
+	write_seqcount_end(&log->seq);
 
+	return 0;
 }
 
 /*
  * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * the log 'log' at position 'pos'
  *
- * The caller needs to hold log->mutex.
+ * The caller must have reserved the range.
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, u64 pos,
 				      const void __user *buf, size_t count)
 {
+	size_t off = logger_offset(pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
 		if (copy_from_user(log->buffer, buf + len, count - len))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
-
 	return count;
 }
 
@@ -419,10 +486,12 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
+	__u16 state = sizeof(struct logger_entry);
 	ssize_t ret = 0;
+	u64 pos;
+	int err;
 
 	now = current_kernel_time();
 
@@ -432,24 +501,30 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.nsec = now.tv_nsec;
 	header.euid = current_euid();
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
-	header.hdr_size = sizeof(struct logger_entry);
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
 	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
+	 * If the ring is full up to an entry still being written, wait for it
+	 * to be committed. Nobody can reclaim it before that, so its header
+	 * stays in place, and the commit wakes up log->wq.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	for (;;) {
+		spin_lock(&log->lock);
+		err = logger_reserve(log, &header,
+				     logger_entry_size(header.len), &pos);
+		spin_unlock(&log->lock);
+		if (likely(!err))
+			break;
+		if (wait_event_interruptible(log->wq,
+				ACCESS_ONCE(*logger_entry_state(log, pos)) !=
+				LOGGER_ENTRY_PENDING))
+			return -EINTR;
+	}
 
+	pos += sizeof(struct logger_entry);
 	while (nr_segs-- > 0) {
 		size_t len;
 		ssize_t nr;
@@ -458,18 +533,21 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log, pos + ret, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+			state = LOGGER_ENTRY_DISCARDED;
+			ret = nr;
+			break;
 		}
 
 		iov++;
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
+	/* commit: the payload must be visible before the entry is */
+	pos -= sizeof(struct logger_entry);
+	smp_wmb();
+	ACCESS_ONCE(*logger_entry_state(log, pos)) = state;
 
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
@@ -509,12 +587,8 @@ static int logger_open(struct inode *inode, struct file *file)
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
 
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+		logger_get_pos(log, NULL, NULL, &reader->r_pos);
 
 		file->private_data = reader;
 	} else
@@ -532,7 +606,6 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
 		kfree(reader);
 	}
 
@@ -562,14 +635,8 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	if (log->w_off != reader->r_off)
+	if (logger_readable(reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
 
 	return ret;
 }
@@ -590,11 +657,16 @@ static long logger_set_version(struct logger_reader *reader, void __user *arg)
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
-	struct logger_reader *reader;
+	struct logger_reader *reader = NULL;
+	struct logger_entry hdr;
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
+	u64 w_pos, head;
 
-	mutex_lock(&log->mutex);
+	if (file->f_mode & FMODE_READ) {
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+	}
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -605,26 +677,18 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		logger_get_pos(log, &w_pos, NULL, &head);
+		if (reader->r_pos < head)
+			reader->r_pos = head;
+		ret = w_pos - reader->r_pos;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-
-		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
-
-		if (log->w_off != reader->r_off)
-			ret = get_user_hdr_len(reader->r_ver) +
-				get_entry_msg_len(log, reader->r_off);
+		if (get_next_entry(log, reader, &hdr))
+			ret = get_user_hdr_len(reader->r_ver) + hdr.len;
 		else
 			ret = 0;
 		break;
@@ -633,9 +697,12 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers pull themselves forward to the new head */
+		spin_lock(&log->lock);
+		write_seqcount_begin(&log->seq);
+		log->head = log->w_pos;
+		write_seqcount_end(&log->seq);
+		spin_unlock(&log->lock);
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -643,7 +710,6 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
 		ret = reader->r_ver;
 		break;
 	case LOGGER_SET_VERSION:
@@ -651,12 +717,12 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
 		ret = logger_set_version(reader, argp);
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	if (reader)
+		mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -678,7 +744,7 @@ static const struct file_operations logger_fops = {
  * (LOGGER_ENTRY_MAX_PAYLOAD + sizeof(struct logger_entry)).
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(LOGGER_ENTRY_ALIGN); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -688,9 +754,10 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
+	.seq = SEQCNT_ZERO, \
+	.w_pos = 0, \
+	.tail = 0, \
 	.head = 0, \
 	.size = SIZE, \
 };
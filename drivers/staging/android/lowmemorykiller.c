@@ -16,6 +16,22 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * To avoid walking every process on each shrink call, the driver keeps the
+ * thread groups indexed by oom_adj, updated on fork, exec, oom_adj writes and
+ * task free. /sys/module/lowmemorykiller/parameters/scans, scan_tasks and
+ * scan_us report how many victim searches were done, how many tasks they
+ * looked at and how long they took in total.
+ *
+ * With /sys/module/lowmemorykiller/parameters/pressure_mode set, the driver
+ * also tracks the rate of direct reclaim allocation stalls. While that rate
+ * is at least pressure_stall_rate per second and rising, every minfree level
+ * is scaled by pressure_scale percent, so processes are killed before free
+ * memory actually drops to the configured level. Once the memory of a victim
+ * has been freed the next kill is allowed right away, instead of waiting for
+ * the victim's task_struct to go away or for the one second timeout. Up to
+ * eight victims are tracked at once; untracked_kills counts the kills that
+ * got no lowmemory_kill_freed event because all of them were busy.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -31,10 +47,20 @@
 
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/hash.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
 #include <linux/mm.h>
 #include <linux/oom.h>
 #include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/notifier.h>
+#include <linux/vmstat.h>
+#include <linux/workqueue.h>
+
+#define CREATE_TRACE_POINTS
+#include "lowmemorykiller_trace.h"
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,12 +81,157 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+static uint32_t lowmem_pressure_mode;
+static uint32_t lowmem_pressure_stall_rate = 100;	/* stalls per second */
+static uint32_t lowmem_pressure_scale = 150;		/* percent of minfree */
+
+/* averaged allocation stall rate, protected by lowmem_pressure_lock */
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static unsigned long lowmem_pressure_rate;
+static bool lowmem_pressure_rising;
+static unsigned long lowmem_pressure_stalls;
+static unsigned long lowmem_pressure_jiffies;
+
+/*
+ * Victims whose memory is being waited for, protected by lowmem_victim_lock.
+ * A slot is free while its mm is NULL. Kills made while every slot is busy
+ * are only counted in lowmem_untracked_kills.
+ */
+#define LOWMEM_VICTIM_POLL_MS	10
+#define LOWMEM_VICTIM_TIMEOUT	(5 * HZ)
+#define LOWMEM_MAX_VICTIMS	8
+
+struct lowmem_victim {
+	struct task_struct *task;	/* for comparison only */
+	struct mm_struct *mm;
+	pid_t pid;
+	ktime_t trigger;
+	unsigned long timeout;
+};
+
+static DEFINE_SPINLOCK(lowmem_victim_lock);
+static struct lowmem_victim lowmem_victims[LOWMEM_MAX_VICTIMS];
+static uint32_t lowmem_untracked_kills;
+
+static void lowmem_victim_work_func(struct work_struct *work);
+static DECLARE_DELAYED_WORK(lowmem_victim_work, lowmem_victim_work_func);
+
+static uint32_t lowmem_scans;
+static uint32_t lowmem_scan_tasks;
+static uint32_t lowmem_scan_us;
+
+/*
+ * Candidate index: one lowmem_task per thread group, hashed by group leader
+ * and on the bucket list of its oom_adj. Protected by lowmem_index_lock,
+ * which is taken from the task free notifier, which can run in softirq
+ * context. task_lock() is softirq-unsafe and must not be taken under it;
+ * victim selection pins candidates under the lock and looks at their mm
+ * after dropping it. A pinned task stays in the index until it is freed.
+ */
+#define LOWMEM_NR_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+#define LOWMEM_HASH_BITS	8
+#define LOWMEM_SELECT_BATCH	16
+
+struct lowmem_task {
+	struct hlist_node hnode;	/* in lowmem_task_hash */
+	struct list_head node;		/* in lowmem_buckets[adj] */
+	struct task_struct *task;	/* thread group leader */
+	int adj;
+};
+
+static DEFINE_SPINLOCK(lowmem_index_lock);
+static struct list_head lowmem_buckets[LOWMEM_NR_BUCKETS];
+static struct hlist_head lowmem_task_hash[1 << LOWMEM_HASH_BITS];
+static struct kmem_cache *lowmem_task_cachep;
+
+/*
+ * Cleared if a notifier could not allocate an entry. The index may then be
+ * missing tasks and lowmem_shrink() falls back to walking the task list.
+ */
+static bool lowmem_index_complete = true;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			printk(x);			\
 	} while (0)
 
+static struct list_head *lowmem_bucket(int adj)
+{
+	return &lowmem_buckets[clamp(adj, OOM_DISABLE, OOM_ADJUST_MAX) -
+			       OOM_DISABLE];
+}
+
+static struct hlist_head *lowmem_hash(struct task_struct *task)
+{
+	return &lowmem_task_hash[hash_ptr(task, LOWMEM_HASH_BITS)];
+}
+
+/* Caller must hold lowmem_index_lock */
+static struct lowmem_task *lowmem_find_task(struct task_struct *task)
+{
+	struct lowmem_task *lt;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(lt, pos, lowmem_hash(task), hnode)
+		if (lt->task == task)
+			return lt;
+	return NULL;
+}
+
+/*
+ * Adds the thread group of 'task' to the index, or moves it to the bucket of
+ * 'adj' if it is already there. Called under rcu_read_lock() or tasklist_lock,
+ * so a leader that is still alive here is only freed, and removed from the
+ * index by task_notify_func(), after we are done.
+ */
+static void lowmem_index_task(struct task_struct *task, int adj)
+{
+	struct lowmem_task *lt, *new;
+	unsigned long flags;
+
+	task = task->group_leader;
+	if (!pid_alive(task))
+		return;
+	new = kmem_cache_alloc(lowmem_task_cachep, GFP_ATOMIC);
+
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	lt = lowmem_find_task(task);
+	if (!lt) {
+		lt = new;
+		new = NULL;
+		if (!lt) {
+			lowmem_index_complete = false;
+			goto out;
+		}
+		lt->task = task;
+		hlist_add_head(&lt->hnode, lowmem_hash(task));
+		INIT_LIST_HEAD(&lt->node);
+	}
+	lt->adj = adj;
+	list_move_tail(&lt->node, lowmem_bucket(adj));
+out:
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+	if (new)
+		kmem_cache_free(lowmem_task_cachep, new);
+}
+
+static void lowmem_unindex_task(struct task_struct *task)
+{
+	struct lowmem_task *lt;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	lt = lowmem_find_task(task);
+	if (lt) {
+		hlist_del(&lt->hnode);
+		list_del(&lt->node);
+	}
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+	if (lt)
+		kmem_cache_free(lowmem_task_cachep, lt);
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -76,20 +247,326 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	if (task == lowmem_deathpending)
 		lowmem_deathpending = NULL;
 
+	/*
+	 * not only leaders, de_thread() may have demoted one; the new leader
+	 * was indexed through the oom_adj notifier
+	 */
+	lowmem_unindex_task(task);
+
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+static int
+task_fork_notify_func(struct notifier_block *self, unsigned long clone_flags,
+		      void *data)
+{
+	struct task_struct *task = data;
+
+	if (!(clone_flags & CLONE_THREAD))
+		lowmem_index_task(task, task->signal->oom_adj);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block task_fork_nb = {
+	.notifier_call	= task_fork_notify_func,
+};
+
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long oom_adj,
+		    void *data)
+{
+	lowmem_index_task(data, (int)oom_adj);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block oom_adj_nb = {
+	.notifier_call	= oom_adj_notify_func,
+};
+
+static unsigned long lowmem_allocstalls(void)
+{
+	unsigned long stalls = 0;
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		stalls += per_cpu(vm_event_states, cpu).event[ALLOCSTALL];
+#endif
+	return stalls;
+}
+
+/*
+ * lowmem_pressure_update - samples the allocation stall counter at most every
+ * 100ms and returns true if the stall rate is high and rising.
+ */
+static bool lowmem_pressure_update(void)
+{
+	unsigned long now = jiffies;
+	unsigned long elapsed;
+	unsigned long stalls;
+	unsigned long rate;
+
+	if (!spin_trylock(&lowmem_pressure_lock))
+		goto out;
+	elapsed = now - lowmem_pressure_jiffies;
+	if (elapsed >= HZ / 10) {
+		stalls = lowmem_allocstalls();
+		rate = (stalls - lowmem_pressure_stalls) * HZ / elapsed;
+		/* the last sample is too old to say whether we are rising */
+		if (elapsed > 10 * HZ)
+			lowmem_pressure_rate = rate;
+		lowmem_pressure_rising = rate > lowmem_pressure_rate;
+		lowmem_pressure_rate = (lowmem_pressure_rate + rate) / 2;
+		lowmem_pressure_stalls = stalls;
+		lowmem_pressure_jiffies = now;
+	}
+	spin_unlock(&lowmem_pressure_lock);
+out:
+	return lowmem_pressure_rising &&
+		lowmem_pressure_rate >= lowmem_pressure_stall_rate;
+}
+
+/*
+ * lowmem_track_victim - waits for the address space of a victim to be torn
+ * down, for the lowmemory_kill_freed tracepoint and for pressure_mode.
+ */
+static void lowmem_track_victim(struct task_struct *p, ktime_t trigger)
+{
+	struct lowmem_victim *v = NULL;
+	struct mm_struct *mm;
+	int i;
+
+	task_lock(p);
+	mm = p->mm;
+	if (mm)
+		atomic_inc(&mm->mm_count);
+	task_unlock(p);
+	if (!mm)
+		return;
+
+	spin_lock(&lowmem_victim_lock);
+	for (i = 0; i < LOWMEM_MAX_VICTIMS; i++) {
+		if (!lowmem_victims[i].mm) {
+			v = &lowmem_victims[i];
+			break;
+		}
+	}
+	if (!v) {
+		lowmem_untracked_kills++;
+		spin_unlock(&lowmem_victim_lock);
+		mmdrop(mm);
+		return;
+	}
+	v->task = p;
+	v->mm = mm;
+	v->pid = p->pid;
+	v->trigger = trigger;
+	v->timeout = jiffies + LOWMEM_VICTIM_TIMEOUT;
+	spin_unlock(&lowmem_victim_lock);
+
+	schedule_delayed_work(&lowmem_victim_work,
+			      msecs_to_jiffies(LOWMEM_VICTIM_POLL_MS));
+}
+
+static void lowmem_victim_work_func(struct work_struct *work)
+{
+	struct mm_struct *done[LOWMEM_MAX_VICTIMS];
+	int i, ndone = 0;
+	bool pending = false;
+
+	spin_lock(&lowmem_victim_lock);
+	for (i = 0; i < LOWMEM_MAX_VICTIMS; i++) {
+		struct lowmem_victim *v = &lowmem_victims[i];
+		long rss;
+
+		if (!v->mm)
+			continue;
+		rss = get_mm_rss(v->mm);
+		if (rss > 0 && time_before(jiffies, v->timeout)) {
+			pending = true;
+			continue;
+		}
+		trace_lowmemory_kill_freed(v->pid,
+			ktime_us_delta(ktime_get(), v->trigger), rss);
+		if (lowmem_pressure_mode && rss <= 0 &&
+		    lowmem_deathpending == v->task)
+			lowmem_deathpending = NULL;
+		done[ndone++] = v->mm;
+		v->task = NULL;
+		v->mm = NULL;
+	}
+	spin_unlock(&lowmem_victim_lock);
+
+	if (pending)
+		schedule_delayed_work(&lowmem_victim_work,
+				      msecs_to_jiffies(LOWMEM_VICTIM_POLL_MS));
+	for (i = 0; i < ndone; i++)
+		mmdrop(done[i]);
+}
+
+/*
+ * Pins up to LOWMEM_SELECT_BATCH tasks of bucket 'adj', starting after
+ * 'resume' if it is set, and returns how many. Returns 0 if 'resume' has
+ * moved to another bucket meanwhile.
+ */
+static int lowmem_pin_batch(int adj, struct task_struct *resume,
+			    struct task_struct **batch)
+{
+	struct list_head *head = lowmem_bucket(adj);
+	struct lowmem_task *lt;
+	unsigned long flags;
+	int n = 0;
+
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	if (resume) {
+		lt = lowmem_find_task(resume);
+		if (!lt || lt->adj != adj)
+			goto out;
+	} else {
+		lt = list_entry(head, struct lowmem_task, node);
+	}
+	list_for_each_entry_continue(lt, head, node) {
+		get_task_struct(lt->task);
+		batch[n++] = lt->task;
+		if (n == LOWMEM_SELECT_BATCH)
+			break;
+	}
+out:
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+	return n;
+}
+
+/*
+ * lowmem_select_indexed - finds the largest task in the highest non-empty
+ * oom_adj bucket at or above 'min_adj'. Returns it with a reference held, or
+ * NULL. 'scanned' is set to the number of tasks looked at.
+ */
+static struct task_struct *
+lowmem_select_indexed(int min_adj, int *selected_tasksize,
+		      int *selected_oom_adj, int *scanned)
+{
+	struct task_struct *batch[LOWMEM_SELECT_BATCH];
+	struct task_struct *selected = NULL;
+	struct task_struct *resume;
+	int adj, n, i;
+
+	*scanned = 0;
+	for (adj = OOM_ADJUST_MAX; adj >= min_adj && !selected; adj--) {
+		resume = NULL;
+		do {
+			n = lowmem_pin_batch(adj, resume, batch);
+			if (resume)
+				put_task_struct(resume);
+			/* keep the last one pinned to continue from it */
+			resume = n == LOWMEM_SELECT_BATCH ? batch[n - 1] : NULL;
+			if (resume)
+				get_task_struct(resume);
+
+			for (i = 0; i < n; i++) {
+				struct task_struct *p = batch[i];
+				int tasksize;
+
+				(*scanned)++;
+				task_lock(p);
+				if (!p->mm || !p->signal) {
+					task_unlock(p);
+					put_task_struct(p);
+					continue;
+				}
+				tasksize = get_mm_rss(p->mm);
+				task_unlock(p);
+				if (tasksize <= 0 || (selected &&
+				    tasksize <= *selected_tasksize)) {
+					put_task_struct(p);
+					continue;
+				}
+				if (selected)
+					put_task_struct(selected);
+				selected = p;
+				*selected_tasksize = tasksize;
+				*selected_oom_adj = adj;
+				lowmem_print(2, "select %d (%s), adj %d, "
+					     "size %d, to kill\n", p->pid,
+					     p->comm, adj, tasksize);
+			}
+		} while (resume);
+	}
+
+	return selected;
+}
+
+/*
+ * lowmem_select_scan - like lowmem_select_indexed(), but walks the whole task
+ * list. Used while the index is incomplete.
+ */
+static struct task_struct *
+lowmem_select_scan(int min_adj, int *selected_tasksize,
+		   int *selected_oom_adj, int *scanned)
 {
 	struct task_struct *p;
 	struct task_struct *selected = NULL;
-	int rem = 0;
 	int tasksize;
+
+	*scanned = 0;
+	*selected_oom_adj = min_adj;
+
+	read_lock(&tasklist_lock);
+	for_each_process(p) {
+		struct mm_struct *mm;
+		struct signal_struct *sig;
+		int oom_adj;
+
+		(*scanned)++;
+		task_lock(p);
+		mm = p->mm;
+		sig = p->signal;
+		if (!mm || !sig) {
+			task_unlock(p);
+			continue;
+		}
+		oom_adj = sig->oom_adj;
+		if (oom_adj < min_adj) {
+			task_unlock(p);
+			continue;
+		}
+		tasksize = get_mm_rss(mm);
+		task_unlock(p);
+		if (tasksize <= 0)
+			continue;
+		if (selected) {
+			if (oom_adj < *selected_oom_adj)
+				continue;
+			if (oom_adj == *selected_oom_adj &&
+			    tasksize <= *selected_tasksize)
+				continue;
+		}
+		selected = p;
+		*selected_tasksize = tasksize;
+		*selected_oom_adj = oom_adj;
+		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+			     p->pid, p->comm, oom_adj, tasksize);
+	}
+	if (selected)
+		get_task_struct(selected);
+	read_unlock(&tasklist_lock);
+
+	return selected;
+}
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct task_struct *selected;
+	int rem = 0;
 	int i;
+	int scanned;
+	ktime_t start;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
 	int array_size = ARRAY_SIZE(lowmem_adj);
+	bool boost = lowmem_pressure_mode && lowmem_pressure_update();
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
@@ -110,16 +587,19 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
 	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
+		size_t minfree = lowmem_minfree[i];
+
+		if (boost)
+			minfree = minfree * lowmem_pressure_scale / 100;
+		if (other_free < minfree && other_file < minfree) {
 			min_adj = lowmem_adj[i];
 			break;
 		}
 	}
 	if (sc->nr_to_scan > 0)
-		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
+		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d%s\n",
 			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
-			     min_adj);
+			     min_adj, boost ? ", boosted" : "");
 	rem = global_page_state(NR_ACTIVE_ANON) +
 		global_page_state(NR_ACTIVE_FILE) +
 		global_page_state(NR_INACTIVE_ANON) +
@@ -131,41 +611,17 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	}
 	selected_oom_adj = min_adj;
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
+	start = ktime_get();
+	if (lowmem_index_complete)
+		selected = lowmem_select_indexed(min_adj, &selected_tasksize,
+						 &selected_oom_adj, &scanned);
+	else
+		selected = lowmem_select_scan(min_adj, &selected_tasksize,
+					      &selected_oom_adj, &scanned);
+	lowmem_scans++;
+	lowmem_scan_tasks += scanned;
+	lowmem_scan_us += ktime_us_delta(ktime_get(), start);
 
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-	}
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
@@ -173,11 +629,16 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 		force_sig(SIGKILL, selected);
+		trace_lowmemory_kill(selected, selected_oom_adj,
+				     selected_tasksize, other_free, other_file,
+				     lowmem_pressure_rate, boost,
+				     ktime_us_delta(ktime_get(), start));
+		lowmem_track_victim(selected, start);
 		rem -= selected_tasksize;
+		put_task_struct(selected);
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -188,15 +649,48 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	lowmem_task_cachep = KMEM_CACHE(lowmem_task, 0);
+	if (!lowmem_task_cachep)
+		return -ENOMEM;
+	for (i = 0; i < LOWMEM_NR_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+
 	task_free_register(&task_nb);
+	task_fork_register(&task_fork_nb);
+	register_oom_adj_notifier(&oom_adj_nb);
+
+	/* index the tasks that were forked before the notifiers were set up */
+	read_lock(&tasklist_lock);
+	for_each_process(p)
+		lowmem_index_task(p, p->signal->oom_adj);
+	read_unlock(&tasklist_lock);
+
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	struct lowmem_task *lt, *tmp;
+	int i;
+
 	unregister_shrinker(&lowmem_shrinker);
+	cancel_delayed_work_sync(&lowmem_victim_work);
+	for (i = 0; i < LOWMEM_MAX_VICTIMS; i++)
+		if (lowmem_victims[i].mm)
+			mmdrop(lowmem_victims[i].mm);
+	unregister_oom_adj_notifier(&oom_adj_nb);
+	task_fork_unregister(&task_fork_nb);
 	task_free_unregister(&task_nb);
+	synchronize_rcu();
+
+	for (i = 0; i < LOWMEM_NR_BUCKETS; i++)
+		list_for_each_entry_safe(lt, tmp, &lowmem_buckets[i], node)
+			kmem_cache_free(lowmem_task_cachep, lt);
+	kmem_cache_destroy(lowmem_task_cachep);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -205,6 +699,16 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_mode, lowmem_pressure_mode, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_stall_rate, lowmem_pressure_stall_rate, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_scale, lowmem_pressure_scale, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(scans, lowmem_scans, uint, S_IRUGO);
+module_param_named(scan_tasks, lowmem_scan_tasks, uint, S_IRUGO);
+module_param_named(scan_us, lowmem_scan_us, uint, S_IRUGO);
+module_param_named(untracked_kills, lowmem_untracked_kills, uint, S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
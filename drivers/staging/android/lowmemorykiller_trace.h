@@ -0,0 +1,97 @@
+/* lowmemorykiller_trace.h
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_LOWMEMORYKILLER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LOWMEMORYKILLER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * A victim is sent SIGKILL. select_us is the time since lowmem_shrink()
+ * decided a kill was needed.
+ */
+TRACE_EVENT(lowmemory_kill,
+	TP_PROTO(struct task_struct *p, int adj, int tasksize, int other_free,
+		 int other_file, unsigned long pressure_rate, bool boosted,
+		 s64 select_us),
+	TP_ARGS(p, adj, tasksize, other_free, other_file, pressure_rate,
+		boosted, select_us),
+
+	TP_STRUCT__entry(
+		__field(pid_t, pid)
+		__array(char, comm, TASK_COMM_LEN)
+		__field(int, adj)
+		__field(int, tasksize)
+		__field(int, other_free)
+		__field(int, other_file)
+		__field(unsigned long, pressure_rate)
+		__field(bool, boosted)
+		__field(s64, select_us)
+	),
+
+	TP_fast_assign(
+		__entry->pid = p->pid;
+		memcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+		__entry->adj = adj;
+		__entry->tasksize = tasksize;
+		__entry->other_free = other_free;
+		__entry->other_file = other_file;
+		__entry->pressure_rate = pressure_rate;
+		__entry->boosted = boosted;
+		__entry->select_us = select_us;
+	),
+
+	TP_printk("pid=%d comm=%s adj=%d size=%d ofree=%d ofile=%d "
+		  "stall_rate=%lu boosted=%d select=%lldus",
+		  __entry->pid, __entry->comm, __entry->adj, __entry->tasksize,
+		  __entry->other_free, __entry->other_file,
+		  __entry->pressure_rate, __entry->boosted, __entry->select_us)
+);
+
+/*
+ * The address space of a victim has been torn down, or the driver gave up
+ * waiting for it with rss pages still mapped. latency_us is measured from
+ * the same point as select_us in lowmemory_kill.
+ */
+TRACE_EVENT(lowmemory_kill_freed,
+	TP_PROTO(pid_t pid, s64 latency_us, long rss),
+	TP_ARGS(pid, latency_us, rss),
+
+	TP_STRUCT__entry(
+		__field(pid_t, pid)
+		__field(s64, latency_us)
+		__field(long, rss)
+	),
+
+	TP_fast_assign(
+		__entry->pid = pid;
+		__entry->latency_us = latency_us;
+		__entry->rss = rss;
+	),
+
+	TP_printk("pid=%d latency=%lldus rss=%ld",
+		  __entry->pid, __entry->latency_us, __entry->rss)
+);
+
+#endif /* _LOWMEMORYKILLER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE lowmemorykiller_trace
+#include <trace/define_trace.h>
@@ -29,6 +29,9 @@
 #include <linux/types.h>
 #include <linux/atomic.h>
 #include <linux/math64.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/workqueue.h>
 #include "tmem.h"
 
 #include "../zram/xvmalloc.h" /* if built in drivers/staging */
@@ -96,6 +99,12 @@ static inline bool is_local_client(struct zcache_client *cli)
  * (3) one of PAGE_SIZE/64 "unbuddied" lists indexed by how many chunks
  * the one unbuddied zbud uses.  The data inside a zbpg cannot be
  * read or written unless the zbpg's lock is held.
+ *
+ * Ephemeral gets are exclusive, so a zbud is never read twice; whether
+ * its data is "hot" can only be learned from the history of its key.
+ * A small hashed table remembers keys that were fetched back or that
+ * were asked for after being evicted, and a zbpg created for such a key
+ * gets a CLOCK count that lets it survive that many eviction passes.
  */
 
 #define ZBH_SENTINEL  0x43214321
@@ -115,6 +124,7 @@ struct zbud_hdr {
 struct zbud_page {
 	struct list_head bud_list;
 	spinlock_t lock;
+	unsigned clock; /* eviction passes left to skip, under budlists lock */
 	struct zbud_hdr buddy[ZBUD_MAX_BUDS];
 	DECL_SENTINEL
 	/* followed by NUM_CHUNK aligned CHUNK_SIZE-byte chunks */
@@ -154,6 +164,11 @@ static unsigned long zcache_zbud_cumul_zpages;
 static unsigned long zcache_zbud_cumul_zbytes;
 static unsigned long zcache_compress_poor;
 static unsigned long zcache_mean_compress_poor;
+static unsigned long zcache_eph_get_hits;
+static unsigned long zcache_eph_get_misses;
+static unsigned long zcache_evicted_refaults;
+static unsigned long zcache_zbud_reuse_puts;
+static unsigned long zcache_zbud_evict_spared;
 
 /* forward references */
 static void *zcache_get_free_page(void);
@@ -210,6 +225,79 @@ static char *zbud_data(struct zbud_hdr *zh, unsigned size)
 	return p;
 }
 
+/*
+ * zbud key history
+ *
+ * Each slot holds the upper bits of a key hash, an "evicted" flag and a
+ * saturating reuse count.  Slots are updated without locking: a lost or
+ * mismatched update only costs the policy some accuracy.
+ */
+
+#define ZBUD_HIST_ORDER		12
+#define ZBUD_HIST_EVICTED	0x4
+#define ZBUD_HIST_REUSE_MASK	0x3
+#define ZBUD_HIST_TAG_MASK	(~0x7U)
+
+static u32 zbud_hist[1 << ZBUD_HIST_ORDER];
+
+static u32 *zbud_hist_slot(uint16_t client_id, uint16_t pool_id,
+				struct tmem_oid *oid, uint32_t index, u32 *tag)
+{
+	u32 h;
+
+	h = jhash2((u32 *)oid, sizeof(*oid) / sizeof(u32),
+			index ^ ((u32)client_id << 16 | pool_id));
+	*tag = h & ZBUD_HIST_TAG_MASK;
+	return &zbud_hist[hash_32(h, ZBUD_HIST_ORDER)];
+}
+
+/* return the reuse count recorded for a key, zero if none */
+static unsigned zbud_hist_reuse(uint16_t client_id, uint16_t pool_id,
+				struct tmem_oid *oid, uint32_t index)
+{
+	u32 tag, *slot = zbud_hist_slot(client_id, pool_id, oid, index, &tag);
+	u32 val = ACCESS_ONCE(*slot);
+
+	if ((val & ZBUD_HIST_TAG_MASK) != tag)
+		return 0;
+	return val & ZBUD_HIST_REUSE_MASK;
+}
+
+/*
+ * Note a get for a key: a hit or a miss on a recently evicted key both
+ * count as reuse, a miss on anything else is not recorded.
+ */
+static void zbud_hist_get(uint16_t client_id, uint16_t pool_id,
+				struct tmem_oid *oid, uint32_t index, bool hit)
+{
+	u32 tag, *slot = zbud_hist_slot(client_id, pool_id, oid, index, &tag);
+	u32 val = ACCESS_ONCE(*slot);
+	unsigned reuse = 0;
+
+	if ((val & ZBUD_HIST_TAG_MASK) == tag) {
+		reuse = val & ZBUD_HIST_REUSE_MASK;
+		if (!hit && (val & ZBUD_HIST_EVICTED))
+			zcache_evicted_refaults++;
+		else if (!hit)
+			return;
+	} else if (!hit)
+		return;
+	if (reuse < ZBUD_HIST_REUSE_MASK)
+		reuse++;
+	*slot = tag | reuse;
+}
+
+static void zbud_hist_evict(struct zbud_hdr *zh)
+{
+	u32 tag, *slot = zbud_hist_slot(zh->client_id, zh->pool_id,
+					&zh->oid, zh->index, &tag);
+	u32 val = ACCESS_ONCE(*slot);
+
+	if ((val & ZBUD_HIST_TAG_MASK) != tag)
+		val = 0;
+	*slot = tag | ZBUD_HIST_EVICTED | (val & ZBUD_HIST_REUSE_MASK);
+}
+
 /*
  * zbud raw page management
  */
@@ -237,6 +325,7 @@ static struct zbud_page *zbud_alloc_raw_page(void)
 		INIT_LIST_HEAD(&zbpg->bud_list);
 		zh0 = &zbpg->buddy[0]; zh1 = &zbpg->buddy[1];
 		spin_lock_init(&zbpg->lock);
+		zbpg->clock = 0;
 		if (recycled) {
 			ASSERT_INVERTED_SENTINEL(zbpg, ZBPG);
 			SET_SENTINEL(zbpg, ZBPG);
@@ -335,11 +424,12 @@ static struct zbud_hdr *zbud_create(uint16_t client_id, uint16_t pool_id,
 {
 	struct zbud_hdr *zh0, *zh1, *zh = NULL;
 	struct zbud_page *zbpg = NULL, *ztmp;
-	unsigned nchunks;
+	unsigned nchunks, reuse;
 	char *to;
 	int i, found_good_buddy = 0;
 
 	nchunks = zbud_size_to_chunks(size) ;
+	reuse = zbud_hist_reuse(client_id, pool_id, oid, index);
 	for (i = MAX_CHUNK - nchunks + 1; i > 0; i--) {
 		spin_lock(&zbud_budlists_spinlock);
 		if (!list_empty(&zbud_unbuddied[i].list)) {
@@ -389,6 +479,8 @@ init_zh:
 	zh->oid = *oid;
 	zh->pool_id = pool_id;
 	zh->client_id = client_id;
+	if (reuse > zbpg->clock)
+		zbpg->clock = reuse;
 	/* can wait to copy the data until the list locks are dropped */
 	spin_unlock(&zbud_budlists_spinlock);
 
@@ -400,6 +492,8 @@ init_zh:
 	zcache_zbud_cumul_zpages++;
 	zcache_zbud_curr_zbytes += size;
 	zcache_zbud_cumul_zbytes += size;
+	if (reuse)
+		zcache_zbud_reuse_puts++;
 out:
 	return zh;
 }
@@ -469,6 +563,7 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 			oid[j] = zh->oid;
 			index[j] = zh->index;
 			j++;
+			zbud_hist_evict(zh);
 			zbud_free(zh);
 		}
 	}
@@ -492,10 +587,14 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
  * not held.  In some cases we also trylock not only to avoid waiting on a
  * page in use by another cpu, but also to avoid potential deadlock due to
  * lock inversion.
+ *
+ * Within each list pages are visited oldest first.  A page that still has
+ * CLOCK count is moved to the tail with its count decremented instead of
+ * being evicted, so a walk ends after at most ZBUD_HIST_REUSE_MASK passes.
  */
 static void zbud_evict_pages(int nr)
 {
-	struct zbud_page *zbpg;
+	struct zbud_page *zbpg, *ztmp;
 	int i;
 
 	/* first try freeing any pages on unused list */
@@ -525,7 +624,15 @@ retry_unbud_list_i:
 			spin_unlock_bh(&zbud_budlists_spinlock);
 			continue;
 		}
-		list_for_each_entry(zbpg, &zbud_unbuddied[i].list, bud_list) {
+		list_for_each_entry_safe(zbpg, ztmp, &zbud_unbuddied[i].list,
+						bud_list) {
+			if (zbpg->clock) {
+				zbpg->clock--;
+				list_move_tail(&zbpg->bud_list,
+						&zbud_unbuddied[i].list);
+				zcache_zbud_evict_spared++;
+				continue;
+			}
 			if (unlikely(!spin_trylock(&zbpg->lock)))
 				continue;
 			list_del_init(&zbpg->bud_list);
@@ -549,7 +656,13 @@ retry_bud_list:
 		spin_unlock_bh(&zbud_budlists_spinlock);
 		goto out;
 	}
-	list_for_each_entry(zbpg, &zbud_buddied_list, bud_list) {
+	list_for_each_entry_safe(zbpg, ztmp, &zbud_buddied_list, bud_list) {
+		if (zbpg->clock) {
+			zbpg->clock--;
+			list_move_tail(&zbpg->bud_list, &zbud_buddied_list);
+			zcache_zbud_evict_spared++;
+			continue;
+		}
 		if (unlikely(!spin_trylock(&zbpg->lock)))
 			continue;
 		list_del_init(&zbpg->bud_list);
@@ -965,6 +1078,19 @@ static unsigned long zcache_put_to_flush;
 static unsigned long zcache_aborted_preload;
 static unsigned long zcache_aborted_shrink;
 
+/*
+ * counters for the asynchronous cleancache put queue: depth is protected
+ * by zcache_putq_lock, the others are approximate like the ones above
+ */
+static unsigned long zcache_putq_depth;
+static unsigned long zcache_putq_depth_max;
+static unsigned long zcache_putq_dropped;
+static unsigned long zcache_putq_hits;
+static unsigned long zcache_putq_cancelled;
+
+/* at most this many pages wait to be compressed; 0 means synchronous puts */
+static unsigned int zcache_putq_max_depth = 256;
+
 /*
  * Ensure that memory allocation requests in zcache don't result
  * in direct reclaim requests via the shrinker, which would cause
@@ -1420,6 +1546,11 @@ ZCACHE_SYSFS_RO(zbpg_unused_list_count);
 ZCACHE_SYSFS_RO(evicted_raw_pages);
 ZCACHE_SYSFS_RO(evicted_unbuddied_pages);
 ZCACHE_SYSFS_RO(evicted_buddied_pages);
+ZCACHE_SYSFS_RO(evicted_refaults);
+ZCACHE_SYSFS_RO(eph_get_hits);
+ZCACHE_SYSFS_RO(eph_get_misses);
+ZCACHE_SYSFS_RO(zbud_reuse_puts);
+ZCACHE_SYSFS_RO(zbud_evict_spared);
 ZCACHE_SYSFS_RO(failed_get_free_pages);
 ZCACHE_SYSFS_RO(failed_alloc);
 ZCACHE_SYSFS_RO(put_to_flush);
@@ -1427,6 +1558,11 @@ ZCACHE_SYSFS_RO(aborted_preload);
 ZCACHE_SYSFS_RO(aborted_shrink);
 ZCACHE_SYSFS_RO(compress_poor);
 ZCACHE_SYSFS_RO(mean_compress_poor);
+ZCACHE_SYSFS_RO(putq_depth);
+ZCACHE_SYSFS_RO(putq_depth_max);
+ZCACHE_SYSFS_RO(putq_dropped);
+ZCACHE_SYSFS_RO(putq_hits);
+ZCACHE_SYSFS_RO(putq_cancelled);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_raw_pages);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_zpages);
 ZCACHE_SYSFS_RO_ATOMIC(curr_obj_count);
@@ -1440,6 +1576,41 @@ ZCACHE_SYSFS_RO_CUSTOM(zv_curr_dist_counts,
 ZCACHE_SYSFS_RO_CUSTOM(zv_cumul_dist_counts,
 			zv_cumul_dist_counts_show);
 
+/*
+ * setting putq_max_depth via sysfs bounds the number of clean pages
+ * copied aside for the put workers; puts beyond it are dropped.  Zero
+ * makes cleancache puts compress synchronously again.
+ */
+static ssize_t zcache_putq_max_depth_show(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  char *buf)
+{
+	return sprintf(buf, "%u\n", zcache_putq_max_depth);
+}
+
+static ssize_t zcache_putq_max_depth_store(struct kobject *kobj,
+					   struct kobj_attribute *attr,
+					   const char *buf, size_t count)
+{
+	unsigned long val;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	err = strict_strtoul(buf, 10, &val);
+	if (err || (val > 4096))
+		return -EINVAL;
+	zcache_putq_max_depth = val;
+	return count;
+}
+
+static struct kobj_attribute zcache_putq_max_depth_attr = {
+		.attr = { .name = "putq_max_depth", .mode = 0644 },
+		.show = zcache_putq_max_depth_show,
+		.store = zcache_putq_max_depth_store,
+};
+
 static struct attribute *zcache_attrs[] = {
 	&zcache_curr_obj_count_attr.attr,
 	&zcache_curr_obj_count_max_attr.attr,
@@ -1463,11 +1634,22 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_evicted_raw_pages_attr.attr,
 	&zcache_evicted_unbuddied_pages_attr.attr,
 	&zcache_evicted_buddied_pages_attr.attr,
+	&zcache_evicted_refaults_attr.attr,
+	&zcache_eph_get_hits_attr.attr,
+	&zcache_eph_get_misses_attr.attr,
+	&zcache_zbud_reuse_puts_attr.attr,
+	&zcache_zbud_evict_spared_attr.attr,
 	&zcache_failed_get_free_pages_attr.attr,
 	&zcache_failed_alloc_attr.attr,
 	&zcache_put_to_flush_attr.attr,
 	&zcache_aborted_preload_attr.attr,
 	&zcache_aborted_shrink_attr.attr,
+	&zcache_putq_depth_attr.attr,
+	&zcache_putq_depth_max_attr.attr,
+	&zcache_putq_dropped_attr.attr,
+	&zcache_putq_hits_attr.attr,
+	&zcache_putq_cancelled_attr.attr,
+	&zcache_putq_max_depth_attr.attr,
 	&zcache_zbud_unbuddied_list_counts_attr.attr,
 	&zcache_zbud_cumul_chunk_counts_attr.attr,
 	&zcache_zv_curr_dist_counts_attr.attr,
@@ -1574,6 +1756,13 @@ static int zcache_get_page(int cli_id, int pool_id, struct tmem_oid *oidp,
 		if (atomic_read(&pool->obj_count) > 0)
 			ret = tmem_get(pool, oidp, index, (char *)(page),
 					&size, 0, is_ephemeral(pool));
+		if (is_ephemeral(pool)) {
+			if (ret >= 0)
+				zcache_eph_get_hits++;
+			else
+				zcache_eph_get_misses++;
+			zbud_hist_get(cli_id, pool_id, oidp, index, ret >= 0);
+		}
 		zcache_put_pool(pool);
 	}
 	local_irq_restore(flags);
@@ -1706,6 +1895,276 @@ out:
  */
 
 #ifdef CONFIG_CLEANCACHE
+/*
+ * Asynchronous cleancache puts
+ *
+ * Cleancache puts come from page reclaim with the mapping's tree_lock
+ * held, so compressing there stalls reclaim.  Instead a put copies the
+ * page into a queue entry and per-cpu workers pull entries off the queue
+ * in batches and do the compression and the tmem_put.
+ *
+ * Until a worker has stored it, a queued page stays hashed by its key so
+ * it remains visible: gets are served from the copy and flushes drop it.
+ * An entry a worker is busy with cannot be dropped; a racing get, flush
+ * or newer put marks it cancelled instead, and the worker flushes what it
+ * stored.  When the queue is full or the copy can't be allocated the put
+ * is dropped and, as for any failed put, an older copy is flushed.
+ *
+ * Frontswap puts stay synchronous, since frontswap must know whether the
+ * page was stored before it skips the swap write.
+ */
+#define ZCACHE_PUTQ_HASH_BITS	6
+#define ZCACHE_PUTQ_BATCH	16
+
+struct zcache_putq_entry {
+	struct list_head list;		/* pending entries, oldest first */
+	struct hlist_node hash;		/* lookup by key until stored */
+	struct tmem_oid oid;
+	uint32_t index;
+	int pool_id;
+	bool busy;			/* a worker is storing it */
+	bool cancelled;			/* flush the stored copy when done */
+	struct page *page;		/* private copy of the data */
+};
+
+static LIST_HEAD(zcache_putq_list);
+static struct hlist_head zcache_putq_hash[1 << ZCACHE_PUTQ_HASH_BITS];
+static DEFINE_SPINLOCK(zcache_putq_lock);
+static struct kmem_cache *zcache_putq_cache;
+static struct workqueue_struct *zcache_putq_wq;
+static DEFINE_PER_CPU(struct work_struct, zcache_putq_work);
+
+static inline struct hlist_head *zcache_putq_bucket(int pool_id,
+					struct tmem_oid *oidp, uint32_t index)
+{
+	unsigned long key = oidp->oid[0] ^ oidp->oid[1] ^ oidp->oid[2];
+
+	return &zcache_putq_hash[hash_long(key ^ index ^ pool_id,
+					   ZCACHE_PUTQ_HASH_BITS)];
+}
+
+/* caller must hold zcache_putq_lock */
+static struct zcache_putq_entry *zcache_putq_find(int pool_id,
+					struct tmem_oid *oidp, uint32_t index)
+{
+	struct zcache_putq_entry *e;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(e, pos, zcache_putq_bucket(pool_id, oidp, index),
+			     hash)
+		if (e->pool_id == pool_id && e->index == index &&
+		    !tmem_oid_compare(&e->oid, oidp))
+			return e;
+	return NULL;
+}
+
+/*
+ * Make an entry invisible to lookups.  Returns true if the caller now
+ * owns (and must free) the entry, false if it is busy and left to its
+ * worker.  Caller must hold zcache_putq_lock.
+ */
+static bool zcache_putq_unhash(struct zcache_putq_entry *e)
+{
+	hlist_del_init(&e->hash);
+	zcache_putq_depth--;
+	if (e->busy) {
+		e->cancelled = true;
+		zcache_putq_cancelled++;
+		return false;
+	}
+	list_del(&e->list);
+	return true;
+}
+
+static void zcache_putq_free(struct zcache_putq_entry *e)
+{
+	__free_page(e->page);
+	kmem_cache_free(zcache_putq_cache, e);
+}
+
+/* returns 0 if the page was queued, -1 if the put was dropped */
+static int zcache_putq_add(int pool_id, struct tmem_oid *oidp,
+				uint32_t index, struct page *page)
+{
+	struct zcache_putq_entry *e, *old;
+	unsigned long flags;
+
+	e = kmem_cache_alloc(zcache_putq_cache, GFP_NOWAIT | __GFP_NOWARN);
+	if (unlikely(e == NULL))
+		goto drop;
+	e->page = alloc_page(GFP_NOWAIT | __GFP_NOWARN | __GFP_NOMEMALLOC);
+	if (unlikely(e->page == NULL)) {
+		kmem_cache_free(zcache_putq_cache, e);
+		goto drop;
+	}
+	copy_highpage(e->page, page);
+	e->oid = *oidp;
+	e->index = index;
+	e->pool_id = pool_id;
+	e->busy = false;
+	e->cancelled = false;
+
+	spin_lock_irqsave(&zcache_putq_lock, flags);
+	old = zcache_putq_find(pool_id, oidp, index);
+	if (old != NULL && zcache_putq_unhash(old))
+		zcache_putq_free(old);
+	if (zcache_putq_depth >= zcache_putq_max_depth) {
+		spin_unlock_irqrestore(&zcache_putq_lock, flags);
+		zcache_putq_free(e);
+		goto drop;
+	}
+	list_add_tail(&e->list, &zcache_putq_list);
+	hlist_add_head(&e->hash, zcache_putq_bucket(pool_id, oidp, index));
+	if (++zcache_putq_depth > zcache_putq_depth_max)
+		zcache_putq_depth_max = zcache_putq_depth;
+	spin_unlock_irqrestore(&zcache_putq_lock, flags);
+
+	/* a no-op if this cpu's worker is already pending */
+	queue_work(zcache_putq_wq, &get_cpu_var(zcache_putq_work));
+	put_cpu_var(zcache_putq_work);
+	return 0;
+
+drop:
+	zcache_putq_dropped++;
+	return -1;
+}
+
+/* serve a get from a page still waiting in the queue */
+static int zcache_putq_get(int pool_id, struct tmem_oid *oidp,
+				uint32_t index, struct page *page)
+{
+	struct zcache_putq_entry *e, *free = NULL;
+	unsigned long flags;
+	int ret = -1;
+
+	if (!ACCESS_ONCE(zcache_putq_depth))
+		return ret;
+
+	spin_lock_irqsave(&zcache_putq_lock, flags);
+	e = zcache_putq_find(pool_id, oidp, index);
+	if (e != NULL) {
+		/* ephemeral gets are exclusive, so the entry goes away */
+		copy_highpage(page, e->page);
+		if (zcache_putq_unhash(e))
+			free = e;
+		zcache_putq_hits++;
+		ret = 0;
+	}
+	spin_unlock_irqrestore(&zcache_putq_lock, flags);
+
+	if (free != NULL)
+		zcache_putq_free(free);
+	return ret;
+}
+
+/* drop queued pages of one object, or of the whole pool if oidp is NULL */
+static void zcache_putq_flush(int pool_id, struct tmem_oid *oidp,
+				bool one_index, uint32_t index)
+{
+	struct zcache_putq_entry *e;
+	struct hlist_node *pos, *n;
+	LIST_HEAD(free_list);
+	unsigned long flags;
+	int i;
+
+	if (!ACCESS_ONCE(zcache_putq_depth))
+		return;
+
+	spin_lock_irqsave(&zcache_putq_lock, flags);
+	if (one_index) {
+		e = zcache_putq_find(pool_id, oidp, index);
+		if (e != NULL && zcache_putq_unhash(e))
+			list_add(&e->list, &free_list);
+	} else {
+		for (i = 0; i < ARRAY_SIZE(zcache_putq_hash); i++)
+			hlist_for_each_entry_safe(e, pos, n,
+						  &zcache_putq_hash[i], hash) {
+				if (e->pool_id != pool_id)
+					continue;
+				if (oidp && tmem_oid_compare(&e->oid, oidp))
+					continue;
+				if (zcache_putq_unhash(e))
+					list_add(&e->list, &free_list);
+			}
+	}
+	spin_unlock_irqrestore(&zcache_putq_lock, flags);
+
+	while (!list_empty(&free_list)) {
+		e = list_first_entry(&free_list, struct zcache_putq_entry,
+				     list);
+		list_del(&e->list);
+		zcache_putq_free(e);
+	}
+}
+
+static void zcache_putq_store(struct zcache_putq_entry *e)
+{
+	unsigned long flags;
+	bool cancelled;
+
+	local_irq_save(flags);
+	(void)zcache_put_page(LOCAL_CLIENT, e->pool_id, &e->oid, e->index,
+				e->page);
+	local_irq_restore(flags);
+
+	spin_lock_irqsave(&zcache_putq_lock, flags);
+	if (!hlist_unhashed(&e->hash)) {
+		hlist_del(&e->hash);
+		zcache_putq_depth--;
+	}
+	cancelled = e->cancelled;
+	spin_unlock_irqrestore(&zcache_putq_lock, flags);
+
+	/* a get, flush or newer put raced with us; don't leave stale data */
+	if (cancelled)
+		(void)zcache_flush_page(LOCAL_CLIENT, e->pool_id, &e->oid,
+					e->index);
+	zcache_putq_free(e);
+}
+
+static void zcache_putq_worker(struct work_struct *work)
+{
+	struct zcache_putq_entry *batch[ZCACHE_PUTQ_BATCH];
+	struct zcache_putq_entry *e;
+	int i, n;
+
+	do {
+		n = 0;
+		spin_lock_irq(&zcache_putq_lock);
+		while (n < ZCACHE_PUTQ_BATCH &&
+		       !list_empty(&zcache_putq_list)) {
+			e = list_first_entry(&zcache_putq_list,
+					     struct zcache_putq_entry, list);
+			list_del_init(&e->list);
+			e->busy = true;
+			batch[n++] = e;
+		}
+		spin_unlock_irq(&zcache_putq_lock);
+
+		for (i = 0; i < n; i++)
+			zcache_putq_store(batch[i]);
+		cond_resched();
+	} while (n == ZCACHE_PUTQ_BATCH);
+}
+
+static int __init zcache_putq_init(void)
+{
+	int cpu;
+
+	zcache_putq_cache = KMEM_CACHE(zcache_putq_entry, 0);
+	if (zcache_putq_cache == NULL)
+		return -ENOMEM;
+	zcache_putq_wq = alloc_workqueue("zcache_put", WQ_MEM_RECLAIM, 0);
+	if (zcache_putq_wq == NULL) {
+		kmem_cache_destroy(zcache_putq_cache);
+		zcache_putq_cache = NULL;
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu)
+		INIT_WORK(&per_cpu(zcache_putq_work, cpu), zcache_putq_worker);
+	return 0;
+}
+
 static void zcache_cleancache_put_page(int pool_id,
 					struct cleancache_filekey key,
 					pgoff_t index, struct page *page)
@@ -1713,8 +2172,13 @@ static void zcache_cleancache_put_page(int pool_id,
 	u32 ind = (u32) index;
 	struct tmem_oid oid = *(struct tmem_oid *)&key;
 
-	if (likely(ind == index))
+	if (unlikely(ind != index))
+		return;
+	if (zcache_putq_wq == NULL || !zcache_putq_max_depth)
 		(void)zcache_put_page(LOCAL_CLIENT, pool_id, &oid, index, page);
+	else if (zcache_putq_add(pool_id, &oid, ind, page) < 0)
+		/* the put fails, so make sure no older copy survives it */
+		(void)zcache_flush_page(LOCAL_CLIENT, pool_id, &oid, ind);
 }
 
 static int zcache_cleancache_get_page(int pool_id,
@@ -1725,8 +2189,12 @@ static int zcache_cleancache_get_page(int pool_id,
 	struct tmem_oid oid = *(struct tmem_oid *)&key;
 	int ret = -1;
 
-	if (likely(ind == index))
-		ret = zcache_get_page(LOCAL_CLIENT, pool_id, &oid, index, page);
+	if (likely(ind == index)) {
+		ret = zcache_putq_get(pool_id, &oid, ind, page);
+		if (ret < 0)
+			ret = zcache_get_page(LOCAL_CLIENT, pool_id, &oid,
+						index, page);
+	}
 	return ret;
 }
 
@@ -1737,8 +2205,10 @@ static void zcache_cleancache_flush_page(int pool_id,
 	u32 ind = (u32) index;
 	struct tmem_oid oid = *(struct tmem_oid *)&key;
 
-	if (likely(ind == index))
+	if (likely(ind == index)) {
+		zcache_putq_flush(pool_id, &oid, true, ind);
 		(void)zcache_flush_page(LOCAL_CLIENT, pool_id, &oid, ind);
+	}
 }
 
 static void zcache_cleancache_flush_inode(int pool_id,
@@ -1746,13 +2216,16 @@ static void zcache_cleancache_flush_inode(int pool_id,
 {
 	struct tmem_oid oid = *(struct tmem_oid *)&key;
 
+	zcache_putq_flush(pool_id, &oid, false, 0);
 	(void)zcache_flush_object(LOCAL_CLIENT, pool_id, &oid);
 }
 
 static void zcache_cleancache_flush_fs(int pool_id)
 {
-	if (pool_id >= 0)
+	if (pool_id >= 0) {
+		zcache_putq_flush(pool_id, NULL, false, 0);
 		(void)zcache_destroy_pool(LOCAL_CLIENT, pool_id);
+	}
 }
 
 static int zcache_cleancache_init_fs(size_t pagesize)
@@ -1977,6 +2450,9 @@ static int __init zcache_init(void)
 		struct cleancache_ops old_ops;
 
 		zbud_init();
+		if (zcache_putq_init())
+			pr_warning("zcache: can't start put workers, "
+				   "cleancache puts will be synchronous\n");
 		register_shrinker(&zcache_shrinker);
 		old_ops = zcache_cleancache_register_ops();
 		pr_info("zcache: cleancache enabled using kernel "
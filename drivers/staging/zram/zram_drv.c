@@ -28,8 +28,11 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/completion.h>
+#include <linux/fs.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/crypto.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -39,6 +42,11 @@
 static int zram_major;
 struct zram *devices;
 
+/* Backing device I/O and writeback */
+static struct workqueue_struct *zram_wq;
+/* Completes multi-page reads split across CPUs */
+static struct workqueue_struct *zram_read_wq;
+
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
@@ -133,15 +141,168 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+static unsigned long zram_alloc_blk(struct zram *zram)
+{
+	unsigned long blk;
+
+	spin_lock(&zram->bitmap_lock);
+	blk = find_next_zero_bit(zram->bitmap, zram->nr_blocks, 1);
+	if (blk == zram->nr_blocks)
+		blk = 0;
+	else
+		__set_bit(blk, zram->bitmap);
+	spin_unlock(&zram->bitmap_lock);
+
+	return blk;
+}
+
+static void zram_free_blk(struct zram *zram, unsigned long blk)
+{
+	spin_lock(&zram->bitmap_lock);
+	WARN_ON(!__test_and_clear_bit(blk, zram->bitmap));
+	spin_unlock(&zram->bitmap_lock);
+}
+
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/*
+ * Synchronous single page I/O to the backing device. Must not be called
+ * from zram_make_request() context: bios submitted there are only
+ * issued once it returns (see zram_bdev_read()).
+ */
+static int zram_bdev_rw(struct zram *zram, struct page *page,
+			unsigned long blk, int rw)
+{
+	int ret;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(rw, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+struct zram_bdev_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_bdev_read_work(struct work_struct *work)
+{
+	struct zram_bdev_work *bw = container_of(work, struct zram_bdev_work,
+						 work);
+
+	bw->ret = zram_bdev_rw(bw->zram, bw->page, bw->blk, READ);
+}
+
+/*
+ * Read a written back page from the I/O path. The bio is issued from
+ * zram_wq and waited for here, since a bio submitted from within our
+ * own make_request function would not be started until we return.
+ */
+static int zram_bdev_read(struct zram *zram, struct page *page,
+			  unsigned long blk)
+{
+	struct zram_bdev_work bw;
+
+	bw.zram = zram;
+	bw.page = page;
+	bw.blk = blk;
+	INIT_WORK_ONSTACK(&bw.work, zram_bdev_read_work);
+	queue_work(zram_wq, &bw.work);
+	flush_work(&bw.work);
+	destroy_work_on_stack(&bw.work);
+
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+
+	return bw.ret;
+}
+
+/* zsmalloc handle of the object holding a compressed page */
+static unsigned long zram_obj_handle(struct zram *zram, u32 index)
+{
+	unsigned long handle = zram->table[index].handle;
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		return ((struct zram_dedup *)handle)->handle;
+
+	return handle;
+}
+
+static void zram_dedup_insert(struct zram *zram, struct zram_dedup *new)
+{
+	struct rb_node **p, *parent = NULL;
+	struct zram_dedup *dedup;
+
+	spin_lock(&zram->dedup_lock);
+	p = &zram->dedup_tree.rb_node;
+	while (*p) {
+		parent = *p;
+		dedup = rb_entry(parent, struct zram_dedup, node);
+
+		/* Equal checksums go right, keeping them adjacent */
+		if (new->checksum < dedup->checksum)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &zram->dedup_tree);
+	spin_unlock(&zram->dedup_lock);
+}
+
+/*
+ * Drop a reference to a shared object, freeing it with the last one.
+ * Returns 1 if the object was freed.
+ */
+static int zram_dedup_put(struct zram *zram, struct zram_dedup *dedup)
+{
+	spin_lock(&zram->dedup_lock);
+	if (--dedup->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		return 0;
+	}
+	rb_erase(&dedup->node, &zram->dedup_tree);
+	spin_unlock(&zram->dedup_lock);
+
+	zs_free(zram->mem_pool, dedup->handle);
+	kfree(dedup);
+
+	return 1;
+}
+
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	u32 clen;
-	void *obj;
+	unsigned long handle = zram->table[index].handle;
+	u16 size = zram->table[index].size;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 
-	if (unlikely(!page)) {
+	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -153,28 +314,43 @@ static void zram_free_page(struct zram *zram, size_t index)
 		return;
 	}
 
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_free_blk(zram, handle);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_stat_dec(&zram->stats.bd_count);
+		zram_stat_dec(&zram->stats.pages_stored);
+		goto clear;
+	}
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page((struct page *)handle);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		if (!zram_dedup_put(zram, (struct zram_dedup *)handle)) {
+			/* Object still used by other pages */
+			zram_stat64_sub(zram, &zram->stats.dedup_saved, size);
+			zram_stat_dec(&zram->stats.pages_stored);
+			goto clear;
+		}
+	} else {
+		zs_free(zram->mem_pool, handle);
+	}
 
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
+	if (size <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
+	zram_stat64_sub(zram, &zram->stats.compr_size, size);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+clear:
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
 }
 
 static void handle_zero_page(struct bio_vec *bvec)
@@ -196,7 +372,7 @@ static void handle_uncompressed_page(struct zram *zram, struct bio_vec *bvec,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1);
+	cmem = kmap_atomic((struct page *)zram->table[index].handle, KM_USER1);
 
 	memcpy(user_mem + bvec->bv_offset, cmem + offset, bvec->bv_len);
 	kunmap_atomic(cmem, KM_USER1);
@@ -210,13 +386,162 @@ static inline int is_partial_io(struct bio_vec *bvec)
 	return bvec->bv_len != PAGE_SIZE;
 }
 
-static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
-			  u32 index, int offset, struct bio *bio)
+static int handle_written_back_page(struct zram *zram, struct bio_vec *bvec,
+				    u32 index, int offset)
+{
+	int ret;
+	struct page *page = bvec->bv_page;
+	struct page *tmp_page;
+	unsigned char *user_mem, *tmp;
+
+	if (!is_partial_io(bvec)) {
+		ret = zram_bdev_read(zram, page, zram->table[index].handle);
+		goto out;
+	}
+
+	tmp_page = alloc_page(GFP_NOIO);
+	if (!tmp_page)
+		return -ENOMEM;
+
+	ret = zram_bdev_read(zram, tmp_page, zram->table[index].handle);
+	if (!ret) {
+		user_mem = kmap_atomic(page, KM_USER0);
+		tmp = kmap_atomic(tmp_page, KM_USER1);
+		memcpy(user_mem + bvec->bv_offset, tmp + offset, bvec->bv_len);
+		kunmap_atomic(tmp, KM_USER1);
+		kunmap_atomic(user_mem, KM_USER0);
+	}
+	__free_page(tmp_page);
+
+out:
+	if (unlikely(ret)) {
+		pr_err("Backing device read failed! err=%d, page=%u\n",
+		       ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return ret;
+	}
+
+	flush_dcache_page(page);
+
+	return 0;
+}
+
+/*
+ * Decompress the @size bytes at @cmem into @mem, which must have room
+ * for a full page.
+ */
+static int zram_decompress(struct zram_strm *zstrm, unsigned char *cmem,
+			   unsigned int size, unsigned char *mem)
+{
+	int ret;
+	unsigned int clen = PAGE_SIZE;
+
+	ret = crypto_comp_decompress(zstrm->tfm, cmem, size, mem, &clen);
+	if (!ret && clen != PAGE_SIZE)
+		ret = -EINVAL;
+
+	return ret;
+}
+
+static u32 zram_dedup_checksum(void *mem)
+{
+	return jhash2(mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+/* Caller holds a reference on dedup, but not dedup_lock */
+static int zram_dedup_match(struct zram *zram, struct zram_strm *zstrm,
+			    struct zram_dedup *dedup, void *mem)
+{
+	int ret;
+	unsigned char *cmem;
+
+	cmem = zs_map_object(zram->mem_pool, dedup->handle, ZS_MM_RO);
+	ret = zram_decompress(zstrm, cmem, dedup->size, zstrm->buffer);
+	zs_unmap_object(zram->mem_pool, dedup->handle);
+
+	return !ret && !memcmp(mem, zstrm->buffer, PAGE_SIZE);
+}
+
+/*
+ * Drop the reference zram_dedup_get() took on a candidate that did not
+ * match. If every page using it was freed meanwhile, the last table entry
+ * was accounted as a shared one; move its size back to compr_size before
+ * it goes away.
+ */
+static void zram_dedup_unpin(struct zram *zram, struct zram_dedup *dedup)
+{
+	u16 size = dedup->size;
+
+	if (!zram_dedup_put(zram, dedup))
+		return;
+
+	zram_stat64_add(zram, &zram->stats.dedup_saved, size);
+	zram_stat64_sub(zram, &zram->stats.compr_size, size);
+	if (size <= PAGE_SIZE / 2)
+		zram_stat_dec(&zram->stats.good_compress);
+}
+
+/*
+ * Look for a stored object whose contents are identical to @mem and
+ * take a reference on it. Checksums only select the candidates; the
+ * contents are always compared, without dedup_lock held. A reference
+ * keeps the candidate in the tree meanwhile, and the object it points
+ * to never changes, so a match needs no further checking.
+ */
+static struct zram_dedup *zram_dedup_get(struct zram *zram,
+					 struct zram_strm *zstrm,
+					 void *mem, u32 checksum)
+{
+	struct rb_node *rb;
+	struct zram_dedup *dedup, *next, *first = NULL;
+
+	spin_lock(&zram->dedup_lock);
+	rb = zram->dedup_tree.rb_node;
+	while (rb) {
+		dedup = rb_entry(rb, struct zram_dedup, node);
+
+		if (checksum == dedup->checksum) {
+			first = dedup;
+			rb = rb->rb_left;
+		} else if (checksum < dedup->checksum) {
+			rb = rb->rb_left;
+		} else {
+			rb = rb->rb_right;
+		}
+	}
+	if (first)
+		first->refcount++;
+	spin_unlock(&zram->dedup_lock);
+
+	/* Nodes with equal checksums follow the first one in order */
+	dedup = first;
+	while (dedup) {
+		if (zram_dedup_match(zram, zstrm, dedup, mem))
+			return dedup;
+
+		spin_lock(&zram->dedup_lock);
+		rb = rb_next(&dedup->node);
+		next = rb ? rb_entry(rb, struct zram_dedup, node) : NULL;
+		if (next && next->checksum == checksum)
+			next->refcount++;
+		else
+			next = NULL;
+		spin_unlock(&zram->dedup_lock);
+
+		zram_dedup_unpin(zram, dedup);
+		dedup = next;
+	}
+
+	return NULL;
+}
+
+static int zram_bvec_read(struct zram *zram, struct zram_strm *zstrm,
+			  struct bio_vec *bvec, u32 index, int offset,
+			  struct bio *bio)
 {
 	int ret;
-	size_t clen;
+	unsigned long handle;
 	struct page *page;
-	struct zobj_header *zheader;
 	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
@@ -227,13 +552,23 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	}
 
 	/* Requested page is not present in compressed area */
-	if (unlikely(!zram->table[index].page)) {
+	if (unlikely(!zram->table[index].handle)) {
 		pr_debug("Read before write: sector=%lu, size=%u",
 			 (ulong)(bio->bi_sector), bio->bi_size);
 		handle_zero_page(bvec);
 		return 0;
 	}
 
+	/*
+	 * Only readers can race here and they all clear the same bit;
+	 * everything else updating flags holds zram->lock for write.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_IDLE))
+		zram_clear_flag(zram, index, ZRAM_IDLE);
+
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB)))
+		return handle_written_back_page(zram, bvec, index, offset);
+
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		handle_uncompressed_page(zram, bvec, index, offset);
@@ -252,14 +587,11 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	user_mem = kmap_atomic(page, KM_USER0);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
-	clen = PAGE_SIZE;
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-		zram->table[index].offset;
+	handle = zram_obj_handle(zram, index);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    xv_get_object_size(cmem) - sizeof(*zheader),
-				    uncmem, &clen);
+	ret = zram_decompress(zstrm, cmem, zram->table[index].size, uncmem);
 
 	if (is_partial_io(bvec)) {
 		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
@@ -267,11 +599,11 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 		kfree(uncmem);
 	}
 
-	kunmap_atomic(cmem, KM_USER1);
+	zs_unmap_object(zram->mem_pool, handle);
 	kunmap_atomic(user_mem, KM_USER0);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -282,36 +614,51 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	return 0;
 }
 
-static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
+static int zram_read_before_write(struct zram *zram, struct zram_strm *zstrm,
+				  char *mem, u32 index)
 {
 	int ret;
-	size_t clen = PAGE_SIZE;
-	struct zobj_header *zheader;
 	unsigned char *cmem;
 
-	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
-	    !zram->table[index].page) {
+	unsigned long handle = zram->table[index].handle;
+
+	if (zram_test_flag(zram, index, ZRAM_ZERO) || !handle) {
 		memset(mem, 0, PAGE_SIZE);
 		return 0;
 	}
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER0) +
-		zram->table[index].offset;
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		struct page *tmp_page = alloc_page(GFP_NOIO);
+
+		if (!tmp_page)
+			return -ENOMEM;
+
+		ret = zram_bdev_read(zram, tmp_page, handle);
+		if (!ret) {
+			cmem = kmap_atomic(tmp_page, KM_USER0);
+			memcpy(mem, cmem, PAGE_SIZE);
+			kunmap_atomic(cmem, KM_USER0);
+		}
+		__free_page(tmp_page);
+
+		return ret;
+	}
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic((struct page *)handle, KM_USER0);
 		memcpy(mem, cmem, PAGE_SIZE);
 		kunmap_atomic(cmem, KM_USER0);
 		return 0;
 	}
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    xv_get_object_size(cmem) - sizeof(*zheader),
-				    mem, &clen);
-	kunmap_atomic(cmem, KM_USER0);
+	handle = zram_obj_handle(zram, index);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	ret = zram_decompress(zstrm, cmem, zram->table[index].size, mem);
+	zs_unmap_object(zram->mem_pool, handle);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -320,18 +667,125 @@ static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 	return 0;
 }
 
+static void zram_strm_free(struct zram_strm *zstrm)
+{
+	if (!IS_ERR_OR_NULL(zstrm->tfm))
+		crypto_free_comp(zstrm->tfm);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+static struct zram_strm *zram_strm_alloc(const char *compressor)
+{
+	struct zram_strm *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->tfm = crypto_alloc_comp(compressor, 0, 0);
+	/* Incompressible input may expand, so reserve 2 pages */
+	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (IS_ERR(zstrm->tfm) || !zstrm->buffer) {
+		zram_strm_free(zstrm);
+		return NULL;
+	}
+
+	return zstrm;
+}
+
+static void zram_strm_destroy_all(struct zram *zram)
+{
+	struct zram_strm *zstrm;
+
+	while (!list_empty(&zram->strm_idle)) {
+		zstrm = list_first_entry(&zram->strm_idle,
+					 struct zram_strm, list);
+		list_del(&zstrm->list);
+		zram_strm_free(zstrm);
+	}
+	zram->max_strm = 0;
+}
+
+static int zram_strm_create_all(struct zram *zram)
+{
+	int i;
+	struct zram_strm *zstrm;
+
+	for (i = 0; i < num_online_cpus(); i++) {
+		zstrm = zram_strm_alloc(zram->compressor);
+		if (!zstrm) {
+			zram_strm_destroy_all(zram);
+			return -ENOMEM;
+		}
+		list_add(&zstrm->list, &zram->strm_idle);
+		zram->max_strm++;
+	}
+
+	return 0;
+}
+
+/*
+ * Get an idle compression stream, sleeping until one is released
+ * if all of them are in use.
+ */
+static struct zram_strm *zram_strm_find(struct zram *zram)
+{
+	int waited = 0;
+	struct zram_strm *zstrm;
+
+	spin_lock(&zram->strm_lock);
+	while (list_empty(&zram->strm_idle)) {
+		spin_unlock(&zram->strm_lock);
+		if (!waited++)
+			zram_stat64_inc(zram, &zram->stats.strm_waits);
+		wait_event(zram->strm_wait, !list_empty(&zram->strm_idle));
+		spin_lock(&zram->strm_lock);
+	}
+
+	zstrm = list_first_entry(&zram->strm_idle, struct zram_strm, list);
+	list_del(&zstrm->list);
+	spin_unlock(&zram->strm_lock);
+
+	return zstrm;
+}
+
+static void zram_strm_release(struct zram *zram, struct zram_strm *zstrm)
+{
+	spin_lock(&zram->strm_lock);
+	list_add(&zstrm->list, &zram->strm_idle);
+	spin_unlock(&zram->strm_lock);
+
+	/*
+	 * Not conditional on waitqueue_active(): without a full barrier the
+	 * check could be ordered before the list_add() and miss a writer
+	 * that is just going to sleep.
+	 */
+	wake_up(&zram->strm_wait);
+}
+
+/*
+ * Compression is done into a private stream buffer without holding
+ * zram->lock; the lock is only taken to swap the new object into the
+ * table. Partial writes hold it across the whole read-modify-write so
+ * that concurrent updates to other parts of the same page are not lost.
+ */
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
 	int ret;
-	u32 store_offset;
-	size_t clen;
-	struct zobj_header *zheader;
+	int locked = 0;
+	unsigned long handle;
+	unsigned int clen;
+	u32 checksum = 0;
+	int dedup_hit = 0;
+	struct zram_dedup *dedup = NULL;
+	struct zram_strm *zstrm;
 	struct page *page, *page_store;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
+	zstrm = zram_strm_find(zram);
 
 	if (is_partial_io(bvec)) {
 		/*
@@ -344,21 +798,16 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			ret = -ENOMEM;
 			goto out;
 		}
-		ret = zram_read_before_write(zram, uncmem, index);
+
+		down_write(&zram->lock);
+		locked = 1;
+		ret = zram_read_before_write(zram, zstrm, uncmem, index);
 		if (ret) {
 			kfree(uncmem);
 			goto out;
 		}
 	}
 
-	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
-	 */
-	if (zram->table[index].page ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
-
 	user_mem = kmap_atomic(page, KM_USER0);
 
 	if (is_partial_io(bvec))
@@ -371,20 +820,49 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		kunmap_atomic(user_mem, KM_USER0);
 		if (is_partial_io(bvec))
 			kfree(uncmem);
+
+		if (!locked) {
+			down_write(&zram->lock);
+			locked = 1;
+		}
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		clear_bit(index, zram->free_bitmap);
+		if (zram->table[index].handle ||
+		    zram_test_flag(zram, index, ZRAM_ZERO))
+			zram_free_page(zram, index);
+
 		zram_stat_inc(&zram->stats.pages_zero);
 		zram_set_flag(zram, index, ZRAM_ZERO);
 		ret = 0;
 		goto out;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	if (zram->dedup_enable) {
+		checksum = zram_dedup_checksum(uncmem);
+		dedup = zram_dedup_get(zram, zstrm, uncmem, checksum);
+		if (dedup) {
+			kunmap_atomic(user_mem, KM_USER0);
+			if (is_partial_io(bvec))
+				kfree(uncmem);
+			handle = (unsigned long)dedup;
+			clen = dedup->size;
+			dedup_hit = 1;
+			ret = 0;
+			goto store;
+		}
+	}
 
-	kunmap_atomic(user_mem, KM_USER0);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
+	clen = 2 * PAGE_SIZE;
+	ret = crypto_comp_compress(zstrm->tfm, uncmem, PAGE_SIZE,
+				   zstrm->buffer, &clen);
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		if (is_partial_io(bvec))
+			kfree(uncmem);
 		pr_err("Compression failed! err=%d\n", ret);
 		goto out;
 	}
@@ -395,7 +873,17 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	 * errors which has side effect of hanging the system.
 	 */
 	if (unlikely(clen > max_zpage_size)) {
+		/* Keep the data in the stream buffer while we allocate */
+		memcpy(zstrm->buffer, uncmem, PAGE_SIZE);
 		clen = PAGE_SIZE;
+	}
+
+	kunmap_atomic(user_mem, KM_USER0);
+	if (is_partial_io(bvec))
+		kfree(uncmem);
+	src = zstrm->buffer;
+
+	if (unlikely(clen == PAGE_SIZE)) {
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
 			pr_info("Error allocating memory for "
@@ -403,44 +891,69 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			ret = -ENOMEM;
 			goto out;
 		}
+		handle = (unsigned long)page_store;
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, src, clen);
+		kunmap_atomic(cmem, KM_USER1);
+	} else {
+		handle = zs_malloc(zram->mem_pool, clen);
+		if (!handle) {
+			pr_info("Error allocating memory for compressed "
+				"page: %u, size=%u\n", index, clen);
+			ret = -ENOMEM;
+			goto out;
+		}
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+		memcpy(cmem, src, clen);
+		zs_unmap_object(zram->mem_pool, handle);
+	}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
-		zram->table[index].page = page_store;
-		src = kmap_atomic(page, KM_USER0);
-		goto memstore;
+	/* Make the new object available to later identical pages */
+	if (zram->dedup_enable && clen != PAGE_SIZE) {
+		dedup = kmalloc(sizeof(*dedup), GFP_NOIO);
+		if (dedup) {
+			dedup->checksum = checksum;
+			dedup->refcount = 1;
+			dedup->handle = handle;
+			dedup->size = clen;
+			zram_dedup_insert(zram, dedup);
+			handle = (unsigned long)dedup;
+		}
 	}
 
-	if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-		      &zram->table[index].page, &store_offset,
-		      GFP_NOIO | __GFP_HIGHMEM)) {
-		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
-		ret = -ENOMEM;
-		goto out;
+store:
+	if (!locked) {
+		down_write(&zram->lock);
+		locked = 1;
 	}
 
-memstore:
-	zram->table[index].offset = store_offset;
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now. A deferred free of the slot is for its
+	 * old contents and must not hit the page stored here.
+	 */
+	clear_bit(index, zram->free_bitmap);
+	if (zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_ZERO))
+		zram_free_page(zram, index);
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-		zram->table[index].offset;
+	zram->table[index].handle = handle;
+	zram->table[index].size = clen;
 
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
-#endif
+	if (dedup)
+		zram_set_flag(zram, index, ZRAM_DEDUP);
 
-	memcpy(cmem, src, clen);
+	if (dedup_hit) {
+		/* Stored data is shared with other pages */
+		zram_stat64_add(zram, &zram->stats.dedup_saved, clen);
+		zram_stat_inc(&zram->stats.pages_stored);
+		goto out;
+	}
 
-	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-		kunmap_atomic(src, KM_USER0);
+	if (unlikely(clen == PAGE_SIZE)) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	}
 
 	/* Update stats */
 	zram_stat64_add(zram, &zram->stats.compr_size, clen);
@@ -448,9 +961,11 @@ memstore:
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_inc(&zram->stats.good_compress);
 
-	return 0;
-
 out:
+	if (locked)
+		up_write(&zram->lock);
+	zram_strm_release(zram, zstrm);
+
 	if (ret)
 		zram_stat64_inc(zram, &zram->stats.failed_writes);
 	return ret;
@@ -460,15 +975,17 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 			int offset, struct bio *bio, int rw)
 {
 	int ret;
+	struct zram_strm *zstrm;
 
 	if (rw == READ) {
+		/* Always take the stream before zram->lock, as writers do */
+		zstrm = zram_strm_find(zram);
 		down_read(&zram->lock);
-		ret = zram_bvec_read(zram, bvec, index, offset, bio);
+		ret = zram_bvec_read(zram, zstrm, bvec, index, offset, bio);
 		up_read(&zram->lock);
+		zram_strm_release(zram, zstrm);
 	} else {
-		down_write(&zram->lock);
 		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
 	}
 
 	return ret;
@@ -481,6 +998,137 @@ static void update_position(u32 *index, int *offset, struct bio_vec *bvec)
 	*offset = (*offset + bvec->bv_len) % PAGE_SIZE;
 }
 
+/*
+ * Handle one bio segment. zram_bvec_rw() can only operate on a single
+ * zram page, so segments that cross a page boundary are split.
+ */
+static int zram_segment_rw(struct zram *zram, struct bio_vec *bvec,
+			   u32 index, int offset, struct bio *bio, int rw)
+{
+	int max_transfer_size = PAGE_SIZE - offset;
+	struct bio_vec bv;
+
+	if (bvec->bv_len <= max_transfer_size)
+		return zram_bvec_rw(zram, bvec, index, offset, bio, rw);
+
+	bv.bv_page = bvec->bv_page;
+	bv.bv_len = max_transfer_size;
+	bv.bv_offset = bvec->bv_offset;
+
+	if (zram_bvec_rw(zram, &bv, index, offset, bio, rw) < 0)
+		return -EIO;
+
+	bv.bv_len = bvec->bv_len - max_transfer_size;
+	bv.bv_offset += max_transfer_size;
+
+	return zram_bvec_rw(zram, &bv, index + 1, 0, bio, rw);
+}
+
+static void zram_read_chunk(struct zram_read_chunk *chunk)
+{
+	int i;
+	struct zram_read_req *req = chunk->req;
+	struct bio *bio = req->bio;
+	u32 index = chunk->index;
+	int offset = chunk->offset;
+
+	for (i = chunk->first; i < chunk->last; i++) {
+		struct bio_vec *bvec = bio_iovec_idx(bio, i);
+
+		if (zram_segment_rw(req->zram, bvec, index, offset,
+				    bio, READ) < 0) {
+			req->error = 1;
+			break;
+		}
+		update_position(&index, &offset, bvec);
+	}
+
+	if (!atomic_dec_and_test(&req->pending))
+		return;
+
+	if (req->error) {
+		bio_io_error(bio);
+	} else {
+		set_bit(BIO_UPTODATE, &bio->bi_flags);
+		bio_endio(bio, 0);
+	}
+	if (atomic_dec_and_test(&req->zram->async_inflight))
+		wake_up(&req->zram->async_wait);
+	kfree(req);
+}
+
+static void zram_read_work(struct work_struct *work)
+{
+	zram_read_chunk(container_of(work, struct zram_read_chunk, work));
+}
+
+/*
+ * Split a multi-page read into one chunk of segments per online CPU.
+ * The submitter decompresses the first chunk itself while the others
+ * run on zram_read_wq, bound to their CPUs. Returns 0 if the bio was
+ * taken over, or -ENOMEM to have it handled synchronously.
+ */
+static int zram_read_async(struct zram *zram, struct bio *bio)
+{
+	int i, cpu, this_cpu, nr_chunks, per_chunk, offset;
+	u32 index;
+	struct zram_read_req *req;
+	struct zram_read_chunk *chunk;
+	struct bio_vec *bvec;
+
+	nr_chunks = min_t(int, num_online_cpus(), bio_segments(bio));
+	per_chunk = DIV_ROUND_UP(bio_segments(bio), nr_chunks);
+	nr_chunks = DIV_ROUND_UP(bio_segments(bio), per_chunk);
+
+	req = kmalloc(sizeof(*req) + nr_chunks * sizeof(req->chunks[0]),
+		      GFP_NOIO);
+	if (!req)
+		return -ENOMEM;
+
+	req->zram = zram;
+	req->bio = bio;
+	req->error = 0;
+	atomic_set(&req->pending, nr_chunks);
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	offset = (bio->bi_sector & (SECTORS_PER_PAGE - 1)) << SECTOR_SHIFT;
+
+	chunk = req->chunks;
+	bio_for_each_segment(bvec, bio, i) {
+		if ((i - bio->bi_idx) % per_chunk == 0) {
+			if (i != bio->bi_idx)
+				chunk++;
+			chunk->req = req;
+			chunk->first = i;
+			chunk->last = min_t(int, i + per_chunk, bio->bi_vcnt);
+			chunk->index = index;
+			chunk->offset = offset;
+			INIT_WORK(&chunk->work, zram_read_work);
+		}
+		update_position(&index, &offset, bvec);
+	}
+
+	zram_stat64_inc(zram, &zram->stats.async_reads);
+	atomic_inc(&zram->async_inflight);
+
+	/* Chunks may complete and free req once queued */
+	chunk = req->chunks;
+	this_cpu = raw_smp_processor_id();
+	i = 1;
+	for_each_online_cpu(cpu) {
+		if (i == nr_chunks)
+			break;
+		if (cpu != this_cpu)
+			queue_work_on(cpu, zram_read_wq, &chunk[i++].work);
+	}
+	while (i < nr_chunks)
+		queue_work(zram_read_wq, &chunk[i++].work);
+
+	zram_read_chunk(&chunk[0]);
+
+	return 0;
+}
+
 static void __zram_make_request(struct zram *zram, struct bio *bio, int rw)
 {
 	int i, offset;
@@ -490,6 +1138,9 @@ static void __zram_make_request(struct zram *zram, struct bio *bio, int rw)
 	switch (rw) {
 	case READ:
 		zram_stat64_inc(zram, &zram->stats.num_reads);
+		if (zram->async_read && bio_segments(bio) > 1 &&
+		    num_online_cpus() > 1 && !zram_read_async(zram, bio))
+			return;
 		break;
 	case WRITE:
 		zram_stat64_inc(zram, &zram->stats.num_writes);
@@ -500,30 +1151,8 @@ static void __zram_make_request(struct zram *zram, struct bio *bio, int rw)
 	offset = (bio->bi_sector & (SECTORS_PER_PAGE - 1)) << SECTOR_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int max_transfer_size = PAGE_SIZE - offset;
-
-		if (bvec->bv_len > max_transfer_size) {
-			/*
-			 * zram_bvec_rw() can only make operation on a single
-			 * zram page. Split the bio vector.
-			 */
-			struct bio_vec bv;
-
-			bv.bv_page = bvec->bv_page;
-			bv.bv_len = max_transfer_size;
-			bv.bv_offset = bvec->bv_offset;
-
-			if (zram_bvec_rw(zram, &bv, index, offset, bio, rw) < 0)
-				goto out;
-
-			bv.bv_len = bvec->bv_len - max_transfer_size;
-			bv.bv_offset += max_transfer_size;
-			if (zram_bvec_rw(zram, &bv, index+1, 0, bio, rw) < 0)
-				goto out;
-		} else
-			if (zram_bvec_rw(zram, bvec, index, offset, bio, rw)
-			    < 0)
-				goto out;
+		if (zram_segment_rw(zram, bvec, index, offset, bio, rw) < 0)
+			goto out;
 
 		update_position(&index, &offset, bvec);
 	}
@@ -576,6 +1205,224 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return 0;
 }
 
+static void zram_close_backing_dev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	vfree(zram->bitmap);
+	kfree(zram->backing_dev);
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->backing_dev = NULL;
+	zram->nr_blocks = 0;
+}
+
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	down_write(&zram->lock);
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (!zram->table[index].handle ||
+		    zram_test_flag(zram, index, ZRAM_WB))
+			continue;
+		zram_set_flag(zram, index, ZRAM_IDLE);
+	}
+	up_write(&zram->lock);
+}
+
+static int zram_wb_eligible(struct zram *zram, u32 index,
+			    enum zram_wb_mode mode)
+{
+	if (!zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_ZERO) ||
+	    zram_test_flag(zram, index, ZRAM_DEDUP) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		return 0;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return zram_test_flag(zram, index, ZRAM_IDLE);
+}
+
+/*
+ * Write back one slot. The page is copied out under zram->lock and
+ * marked ZRAM_UNDER_WB; if the slot is rewritten or freed while the
+ * write is in flight the flag is gone and the block is dropped again.
+ */
+static int zram_writeback_slot(struct zram *zram, struct page *page,
+			       u32 index, enum zram_wb_mode mode)
+{
+	int ret;
+	unsigned long blk;
+	struct zram_strm *zstrm;
+
+	zstrm = zram_strm_find(zram);
+	down_write(&zram->lock);
+	if (!zram->init_done || !zram_wb_eligible(zram, index, mode)) {
+		up_write(&zram->lock);
+		zram_strm_release(zram, zstrm);
+		return 0;
+	}
+	ret = zram_read_before_write(zram, zstrm, page_address(page), index);
+	if (!ret)
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+	up_write(&zram->lock);
+	zram_strm_release(zram, zstrm);
+
+	if (ret)
+		return ret;
+
+	blk = zram_alloc_blk(zram);
+	if (!blk) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	ret = zram_bdev_rw(zram, page, blk, WRITE);
+	if (ret) {
+		zram_free_blk(zram, blk);
+		goto out;
+	}
+
+	down_write(&zram->lock);
+	if (!zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+		up_write(&zram->lock);
+		zram_free_blk(zram, blk);
+		return 0;
+	}
+	zram_free_page(zram, index);
+	zram->table[index].handle = blk;
+	zram_set_flag(zram, index, ZRAM_WB);
+	zram_stat_inc(&zram->stats.pages_stored);
+	zram_stat_inc(&zram->stats.bd_count);
+	zram_stat64_inc(zram, &zram->stats.bd_writes);
+	up_write(&zram->lock);
+
+	return 0;
+
+out:
+	down_write(&zram->lock);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	up_write(&zram->lock);
+
+	return ret;
+}
+
+static void zram_writeback_work(struct work_struct *work)
+{
+	int ret = 0;
+	size_t index;
+	struct page *page;
+	unsigned long pending;
+	enum zram_wb_mode mode;
+	struct zram *zram = container_of(work, struct zram, wb_work);
+
+	pending = xchg(&zram->wb_mode, 0);
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return;
+
+	for (mode = ZRAM_WB_IDLE; mode <= ZRAM_WB_HUGE; mode++) {
+		if (!test_bit(mode, &pending))
+			continue;
+
+		for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+			if (!zram->init_done)
+				goto out;
+
+			ret = zram_writeback_slot(zram, page, index, mode);
+			if (ret == -ENOSPC)
+				goto out;
+			if (ret)
+				pr_err("Writeback failed! err=%d, page=%zu\n",
+				       ret, index);
+
+			cond_resched();
+		}
+	}
+
+out:
+	__free_page(page);
+}
+
+void zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	set_bit(mode, &zram->wb_mode);
+	queue_work(zram_wq, &zram->wb_work);
+}
+
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	int ret;
+	char *name;
+	unsigned long nr_blocks;
+	unsigned long *bitmap = NULL;
+	struct block_device *bdev = NULL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	if (!strcmp(path, "none")) {
+		zram_close_backing_dev(zram);
+		ret = 0;
+		goto out;
+	}
+
+	name = kstrdup(path, GFP_KERNEL);
+	if (!name) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	bdev = blkdev_get_by_path(name, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				  zram);
+	if (IS_ERR(bdev)) {
+		ret = PTR_ERR(bdev);
+		goto free_name;
+	}
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_blocks < 2) {
+		ret = -EINVAL;
+		goto put_bdev;
+	}
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto put_bdev;
+	}
+	/* Block 0 is never used so that a written back handle is never 0 */
+	__set_bit(0, bitmap);
+
+	zram_close_backing_dev(zram);
+	zram->bdev = bdev;
+	zram->backing_dev = name;
+	zram->bitmap = bitmap;
+	zram->nr_blocks = nr_blocks;
+	mutex_unlock(&zram->init_lock);
+
+	pr_info("Set up backing device %s (%lu pages)\n", name, nr_blocks);
+	return 0;
+
+put_bdev:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+free_name:
+	kfree(name);
+out:
+	mutex_unlock(&zram->init_lock);
+	return ret;
+}
+
 void zram_reset_device(struct zram *zram)
 {
 	size_t index;
@@ -583,36 +1430,51 @@ void zram_reset_device(struct zram *zram)
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	/* Writeback and deferred frees check init_done and bail out */
+	flush_work_sync(&zram->wb_work);
+	flush_work_sync(&zram->free_work);
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Split reads still use the table until their last chunk is done */
+	wait_event(zram->async_wait, !atomic_read(&zram->async_inflight));
+
+	/* Free various per-device buffers */
+	zram_strm_destroy_all(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+		unsigned long handle = zram->table[index].handle;
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
+		if (!handle || zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+			__free_page((struct page *)handle);
+		else if (zram_test_flag(zram, index, ZRAM_DEDUP))
+			zram_dedup_put(zram, (struct zram_dedup *)handle);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zs_free(zram->mem_pool, handle);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
+	vfree(zram->free_bitmap);
+	zram->free_bitmap = NULL;
+	zram->dedup_tree = RB_ROOT;
 
-	xv_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
+	/*
+	 * Keep the backing device so that a reset and re-init, to resize
+	 * the disk for example, does not lose writeback. Nothing on it is
+	 * referenced any more.
+	 */
+	if (zram->bitmap) {
+		bitmap_zero(zram->bitmap, zram->nr_blocks);
+		__set_bit(0, zram->bitmap);
+	}
+
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
@@ -634,17 +1496,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_strm_create_all(zram);
+	if (ret) {
+		pr_err("Error allocating compression streams\n");
 		goto fail;
 	}
 
@@ -658,12 +1512,19 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	zram->free_bitmap = vzalloc(BITS_TO_LONGS(num_pages) * sizeof(long));
+	if (!zram->free_bitmap) {
+		pr_err("Error allocating zram free bitmap\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -684,12 +1545,40 @@ fail:
 	return ret;
 }
 
+static void zram_free_work(struct work_struct *work)
+{
+	size_t index, num_pages;
+	struct zram *zram = container_of(work, struct zram, free_work);
+
+	if (!zram->init_done)
+		return;
+
+	num_pages = zram->disksize >> PAGE_SHIFT;
+
+	down_write(&zram->lock);
+	for_each_set_bit(index, zram->free_bitmap, num_pages) {
+		clear_bit(index, zram->free_bitmap);
+		zram_free_page(zram, index);
+	}
+	up_write(&zram->lock);
+}
+
+/*
+ * Called by the swap code with swap_lock held, so this must not sleep.
+ * If zram->lock is busy the slot is left for zram_free_work().
+ */
 void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 {
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
-	zram_free_page(zram, index);
+	if (down_write_trylock(&zram->lock)) {
+		zram_free_page(zram, index);
+		up_write(&zram->lock);
+	} else {
+		set_bit(index, zram->free_bitmap);
+		queue_work(zram_wq, &zram->free_work);
+	}
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -705,6 +1594,18 @@ static int create_device(struct zram *zram, int device_id)
 	init_rwsem(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	INIT_LIST_HEAD(&zram->strm_idle);
+	spin_lock_init(&zram->strm_lock);
+	init_waitqueue_head(&zram->strm_wait);
+	spin_lock_init(&zram->dedup_lock);
+	zram->dedup_tree = RB_ROOT;
+	spin_lock_init(&zram->bitmap_lock);
+	INIT_WORK(&zram->wb_work, zram_writeback_work);
+	INIT_WORK(&zram->free_work, zram_free_work);
+	atomic_set(&zram->async_inflight, 0);
+	init_waitqueue_head(&zram->async_wait);
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -787,11 +1688,24 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	zram_wq = alloc_workqueue("zram", WQ_MEM_RECLAIM, 0);
+	if (!zram_wq) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	zram_read_wq = alloc_workqueue("zram_read",
+				       WQ_MEM_RECLAIM | WQ_HIGHPRI, 0);
+	if (!zram_read_wq) {
+		ret = -ENOMEM;
+		goto destroy_wq;
+	}
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto destroy_read_wq;
 	}
 
 	if (!num_devices) {
@@ -821,6 +1735,10 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+destroy_read_wq:
+	destroy_workqueue(zram_read_wq);
+destroy_wq:
+	destroy_workqueue(zram_wq);
 out:
 	return ret;
 }
@@ -836,9 +1754,12 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_close_backing_dev(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
+	destroy_workqueue(zram_read_wq);
+	destroy_workqueue(zram_wq);
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
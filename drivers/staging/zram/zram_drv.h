@@ -17,8 +17,12 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/crypto.h>
+#include <linux/rbtree.h>
+#include <linux/workqueue.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,19 +30,13 @@
  */
 static const unsigned max_num_devices = 32;
 
+/*-- Configurable parameters */
+
 /*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
+ * Crypto API compression algorithm used unless another one is
+ * selected through the comp_algorithm sysfs node.
  */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
-/*-- Configurable parameters */
+static const char default_compressor[] = "lzo";
 
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
@@ -51,8 +49,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -74,6 +72,18 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* handle points to a struct zram_dedup shared with other pages */
+	ZRAM_DEDUP,
+
+	/* Page was written back; handle is its block on the backing device */
+	ZRAM_WB,
+
+	/* Page not accessed since it was last marked idle */
+	ZRAM_IDLE,
+
+	/* Page is being written back; cleared if it is freed meanwhile */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
@@ -81,8 +91,9 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	unsigned long handle;	/* zsmalloc handle, page if uncompressed
+				 * or struct zram_dedup if deduplicated */
+	u16 size;	/* object size */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
@@ -95,20 +106,107 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 strm_waits;		/* writes that waited for a free stream */
+	u64 dedup_saved;	/* compressed bytes not stored thanks to
+				 * deduplication */
 	u32 pages_zero;		/* no. of zero filled pages */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u32 bd_count;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* reads from the backing device */
+	u64 bd_writes;		/* pages written back */
+	u64 async_reads;	/* read bios split across CPUs */
+};
+
+/* zram->wb_mode bits: which pages the writeback work should flush */
+enum zram_wb_mode {
+	ZRAM_WB_IDLE,		/* pages marked idle and not used since */
+	ZRAM_WB_HUGE,		/* pages stored uncompressed */
+};
+
+/*
+ * A compressed object that may be shared by several identical pages.
+ * Kept in zram->dedup_tree, sorted by checksum of the uncompressed data.
+ */
+struct zram_dedup {
+	struct rb_node node;
+	u32 checksum;
+	u32 refcount;		/* no. of table entries using the object */
+	unsigned long handle;	/* zsmalloc handle */
+	u16 size;
+};
+
+/*
+ * Compression context. One is allocated per online CPU at device init
+ * so that writers on different CPUs can compress concurrently.
+ */
+struct zram_strm {
+	struct crypto_comp *tfm;
+	void *buffer;		/* compressed output, 2 pages */
+	struct list_head list;
+};
+
+/*
+ * A multi-page read bio being completed asynchronously. Its segments
+ * are split into one contiguous chunk per CPU; whichever chunk finishes
+ * last ends the bio.
+ */
+struct zram_read_req;
+
+struct zram_read_chunk {
+	struct work_struct work;
+	struct zram_read_req *req;
+	int first, last;	/* bio segments [first, last) */
+	u32 index;		/* zram page and offset of first segment */
+	int offset;
+};
+
+struct zram_read_req {
+	struct zram *zram;
+	struct bio *bio;
+	atomic_t pending;	/* chunks not completed yet */
+	int error;
+	struct zram_read_chunk chunks[0];
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	struct rw_semaphore lock; /* protect table against concurrent
+				   * read and writes */
+	/* Idle compression streams, handed out by zram_strm_find() */
+	struct list_head strm_idle;
+	spinlock_t strm_lock;	/* protect strm_idle */
+	wait_queue_head_t strm_wait;
+	int max_strm;		/* no. of streams allocated */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+	int dedup_enable;	/* share objects between identical pages */
+	struct rb_root dedup_tree;
+	spinlock_t dedup_lock;	/* protect dedup_tree and refcounts */
+	/*
+	 * Optional backing device that idle or incompressible pages are
+	 * written back to. Block 0 is never used so that a written back
+	 * page always has a non-zero table handle.
+	 */
+	struct block_device *bdev;
+	char *backing_dev;	/* path, as given through sysfs */
+	unsigned long *bitmap;	/* allocated backing device blocks */
+	unsigned long nr_blocks;
+	spinlock_t bitmap_lock;
+	struct work_struct wb_work;
+	unsigned long wb_mode;	/* pending enum zram_wb_mode bits */
+	/*
+	 * Slots whose swap free notification found zram->lock contended.
+	 * The notifier runs under swap_lock and cannot sleep, so these are
+	 * freed later by free_work.
+	 */
+	unsigned long *free_bitmap;
+	struct work_struct free_work;
+	int async_read;		/* split multi-page reads across CPUs */
+	atomic_t async_inflight;	/* split reads not completed yet */
+	wait_queue_head_t async_wait;	/* reset waits for them here */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -131,5 +229,8 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_mark_idle(struct zram *zram);
+extern void zram_writeback(struct zram *zram, enum zram_wb_mode mode);
 
 #endif
@@ -0,0 +1,832 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are grouped into size classes ZS_SIZE_CLASS_DELTA bytes
+ * apart. Each class carves its objects out of "zspages": groups of 1 to
+ * ZS_MAX_PAGES_PER_ZSPAGE 0-order pages, sized so that little space is
+ * left over at the end. Objects are handed out as opaque handles; the
+ * handle stores the current location of the object, so compaction can
+ * move objects from sparsely used zspages into fuller ones and free
+ * the emptied zspages.
+ *
+ * Locking: each size class has a spinlock protecting its zspages and
+ * their freelists. A handle is pinned (bit spinlock in the handle word)
+ * while the object is mapped or being freed; compaction skips pinned
+ * objects instead of waiting for them.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static struct kmem_cache *handle_cachep;
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the number of pages per zspage that wastes the least space
+ * at the end of the zspage for objects of the given class size.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size;
+		int waste, usedpc;
+
+		zspage_size = i * PAGE_SIZE;
+		waste = zspage_size % class_size;
+		usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+/* Handles */
+
+static unsigned long cache_alloc_handle(struct zs_pool *pool)
+{
+	return (unsigned long)kmem_cache_alloc(handle_cachep,
+				pool->flags & ~__GFP_HIGHMEM);
+}
+
+static void cache_free_handle(unsigned long handle)
+{
+	kmem_cache_free(handle_cachep, (void *)handle);
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle & ~BIT(HANDLE_PIN_BIT);
+}
+
+/* Caller must hold the class lock or have the handle pinned */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	unsigned long *ptr = (unsigned long *)handle;
+
+	*ptr = obj | (*ptr & BIT(HANDLE_PIN_BIT));
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+/* Object locations */
+
+static unsigned long obj_location(struct zspage *zspage, unsigned int idx)
+{
+	unsigned long obj;
+
+	obj = page_to_pfn(zspage->pages[0]) << OBJ_INDEX_BITS;
+	obj |= idx & OBJ_INDEX_MASK;
+
+	return obj << OBJ_TAG_BITS;
+}
+
+static struct zspage *obj_to_zspage(unsigned long obj, unsigned int *idx)
+{
+	struct page *page;
+
+	obj >>= OBJ_TAG_BITS;
+	*idx = obj & OBJ_INDEX_MASK;
+	page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+
+	return (struct zspage *)page_private(page);
+}
+
+/* Page and offset within it where the given object starts */
+static struct page *obj_to_page(struct zspage *zspage, unsigned int idx,
+				unsigned long *offset)
+{
+	unsigned long off = (unsigned long)idx * zspage->class->size;
+
+	*offset = off & ~PAGE_MASK;
+	return zspage->pages[off >> PAGE_SHIFT];
+}
+
+/*
+ * Object headers never span pages: objects start at multiples of
+ * ZS_SIZE_CLASS_DELTA, which is a multiple of ZS_HANDLE_SIZE.
+ */
+static unsigned long obj_read_header(struct zspage *zspage, unsigned int idx)
+{
+	unsigned long off, head;
+	struct page *page;
+	void *addr;
+
+	page = obj_to_page(zspage, idx, &off);
+	addr = kmap_atomic(page, KM_USER0);
+	head = *(unsigned long *)(addr + off);
+	kunmap_atomic(addr, KM_USER0);
+
+	return head;
+}
+
+static void obj_write_header(struct zspage *zspage, unsigned int idx,
+			     unsigned long head)
+{
+	unsigned long off;
+	struct page *page;
+	void *addr;
+
+	page = obj_to_page(zspage, idx, &off);
+	addr = kmap_atomic(page, KM_USER0);
+	*(unsigned long *)(addr + off) = head;
+	kunmap_atomic(addr, KM_USER0);
+}
+
+/*
+ * Copy @len bytes between @buf and the object at @idx, starting @start
+ * bytes into the object. The object may span two pages.
+ */
+static void obj_copy(struct zspage *zspage, unsigned int idx,
+		     unsigned long start, char *buf, unsigned long len,
+		     int to_obj)
+{
+	unsigned long off, chunk;
+	struct page *page;
+	char *addr;
+
+	off = (unsigned long)idx * zspage->class->size + start;
+	while (len) {
+		page = zspage->pages[off >> PAGE_SHIFT];
+		chunk = min(len, PAGE_SIZE - (off & ~PAGE_MASK));
+
+		addr = kmap_atomic(page, KM_USER1);
+		if (to_obj)
+			memcpy(addr + (off & ~PAGE_MASK), buf, chunk);
+		else
+			memcpy(buf, addr + (off & ~PAGE_MASK), chunk);
+		kunmap_atomic(addr, KM_USER1);
+
+		off += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+}
+
+/* Copy a whole object between zspages of the same class */
+static void obj_move(struct zspage *src, unsigned int sidx,
+		     struct zspage *dst, unsigned int didx)
+{
+	int size = src->class->size;
+	unsigned long soff, doff, chunk;
+	char *saddr, *daddr;
+
+	soff = (unsigned long)sidx * size;
+	doff = (unsigned long)didx * size;
+	while (size) {
+		chunk = min_t(unsigned long, size,
+			      PAGE_SIZE - (soff & ~PAGE_MASK));
+		chunk = min(chunk, PAGE_SIZE - (doff & ~PAGE_MASK));
+
+		saddr = kmap_atomic(src->pages[soff >> PAGE_SHIFT], KM_USER0);
+		daddr = kmap_atomic(dst->pages[doff >> PAGE_SHIFT], KM_USER1);
+		memcpy(daddr + (doff & ~PAGE_MASK),
+		       saddr + (soff & ~PAGE_MASK), chunk);
+		kunmap_atomic(daddr, KM_USER1);
+		kunmap_atomic(saddr, KM_USER0);
+
+		soff += chunk;
+		doff += chunk;
+		size -= chunk;
+	}
+}
+
+/* zspages */
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					      struct zspage *zspage)
+{
+	unsigned int inuse = zspage->inuse;
+
+	if (!inuse)
+		return ZS_EMPTY;
+	if (inuse == class->objs_per_zspage)
+		return ZS_FULL;
+	if (inuse <= (ZS_ALMOST_EMPTY_FRAC - 1) * class->objs_per_zspage /
+			ZS_ALMOST_EMPTY_FRAC)
+		return ZS_ALMOST_EMPTY;
+
+	return ZS_ALMOST_FULL;
+}
+
+/*
+ * Move zspage to the fullness list matching its current usage.
+ * Called with class->lock held.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					      struct zspage *zspage)
+{
+	enum fullness_group fg = get_fullness_group(class, zspage);
+
+	if (fg != zspage->fullness) {
+		list_move(&zspage->list, &class->fullness_list[fg]);
+		zspage->fullness = fg;
+	}
+
+	return fg;
+}
+
+static void free_zspage(struct zs_pool *pool, struct zspage *zspage)
+{
+	int i;
+	struct size_class *class = zspage->class;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	atomic_long_sub(class->pages_per_zspage, &pool->pages_allocated);
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				   struct size_class *class)
+{
+	int i;
+	unsigned int idx;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage), pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+	zspage->fullness = ZS_EMPTY;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page;
+
+		page = alloc_page(pool->flags);
+		if (!page)
+			goto fail;
+
+		set_page_private(page, (unsigned long)zspage);
+		zspage->pages[i] = page;
+	}
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+
+	/* Link all objects into the freelist */
+	for (idx = 0; idx < class->objs_per_zspage; idx++) {
+		unsigned int next = idx + 1;
+
+		if (next == class->objs_per_zspage)
+			next = OBJ_END;
+		obj_write_header(zspage, idx,
+				 (unsigned long)next << OBJ_TAG_BITS);
+	}
+	zspage->freeidx = 0;
+
+	return zspage;
+
+fail:
+	while (i--) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+
+	return NULL;
+}
+
+/* Called with class->lock held */
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+	/* Fill up the fullest zspages first */
+	static const enum fullness_group order[] = {
+		ZS_ALMOST_FULL, ZS_ALMOST_EMPTY
+	};
+
+	for (i = 0; i < ARRAY_SIZE(order); i++) {
+		struct list_head *head = &class->fullness_list[order[i]];
+
+		if (!list_empty(head))
+			return list_first_entry(head, struct zspage, list);
+	}
+
+	return NULL;
+}
+
+/* Take a free slot in zspage. Called with class->lock held. */
+static unsigned int obj_malloc(struct size_class *class,
+			       struct zspage *zspage, unsigned long handle)
+{
+	unsigned int idx = zspage->freeidx;
+
+	BUG_ON(idx == OBJ_END);
+
+	zspage->freeidx = obj_read_header(zspage, idx) >> OBJ_TAG_BITS;
+	obj_write_header(zspage, idx, handle | OBJ_ALLOCATED_TAG);
+	zspage->inuse++;
+	class->objs_inuse++;
+
+	return idx;
+}
+
+/* Return a slot to the zspage freelist. Called with class->lock held. */
+static void obj_free(struct size_class *class, struct zspage *zspage,
+		     unsigned int idx)
+{
+	obj_write_header(zspage, idx,
+			 (unsigned long)zspage->freeidx << OBJ_TAG_BITS);
+	zspage->freeidx = idx;
+	zspage->inuse--;
+	class->objs_inuse--;
+}
+
+/**
+ * zs_malloc - Allocate an object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of object to allocate
+ *
+ * On success, a non-zero handle to the object is returned. The object
+ * must be mapped with zs_map_object() to access it. Returns 0 on
+ * failure or if size is larger than ZS_MAX_ALLOC_SIZE minus the
+ * object header.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	unsigned int idx;
+	unsigned long handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	size += ZS_HANDLE_SIZE;
+	if (unlikely(size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = cache_alloc_handle(pool);
+	if (!handle)
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			cache_free_handle(handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	idx = obj_malloc(class, zspage, handle);
+	fix_fullness_group(class, zspage);
+	/* Compaction may move the object as soon as the lock is dropped */
+	*(unsigned long *)handle = obj_location(zspage, idx);
+	spin_unlock(&class->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned int idx;
+	struct size_class *class;
+	struct zspage *zspage;
+	enum fullness_group fg;
+
+	if (unlikely(!handle))
+		return;
+
+	pin_tag(handle);
+	zspage = obj_to_zspage(handle_to_obj(handle), &idx);
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(class, zspage, idx);
+	fg = fix_fullness_group(class, zspage);
+	if (fg == ZS_EMPTY) {
+		list_del(&zspage->list);
+		class->zspages--;
+	}
+	spin_unlock(&class->lock);
+	unpin_tag(handle);
+
+	if (fg == ZS_EMPTY)
+		free_zspage(pool, zspage);
+
+	cache_free_handle(handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: mapping mode to use
+ *
+ * Only one object can be mapped per CPU at a time and the caller may
+ * not sleep until zs_unmap_object() is called. The handle is pinned in
+ * between, so compaction will not move the object.
+ *
+ * Uses KM_USER1 for the mapping; callers may hold a KM_USER0 mapping.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	unsigned int idx;
+	unsigned long off;
+	struct page *page;
+	struct zspage *zspage;
+	struct mapping_area *area;
+
+	BUG_ON(!handle);
+
+	pin_tag(handle);
+	zspage = obj_to_zspage(handle_to_obj(handle), &idx);
+	page = obj_to_page(zspage, idx, &off);
+
+	area = &get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
+	if (off + zspage->class->size <= PAGE_SIZE) {
+		/* Object fits in a single page */
+		area->vm_addr = kmap_atomic(page, KM_USER1);
+		return area->vm_addr + off + ZS_HANDLE_SIZE;
+	}
+
+	/* Object spans two pages: go through the copy buffer */
+	area->vm_addr = NULL;
+	if (mm != ZS_MM_WO)
+		obj_copy(zspage, idx, ZS_HANDLE_SIZE, area->vm_buf,
+			 zspage->class->size - ZS_HANDLE_SIZE, 0);
+
+	return area->vm_buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned int idx;
+	struct zspage *zspage;
+	struct mapping_area *area;
+
+	BUG_ON(!handle);
+
+	area = &__get_cpu_var(zs_map_area);
+	if (area->vm_addr) {
+		kunmap_atomic(area->vm_addr, KM_USER1);
+	} else if (area->vm_mm != ZS_MM_RO) {
+		zspage = obj_to_zspage(handle_to_obj(handle), &idx);
+		obj_copy(zspage, idx, ZS_HANDLE_SIZE, area->vm_buf,
+			 zspage->class->size - ZS_HANDLE_SIZE, 1);
+	}
+	put_cpu_var(zs_map_area);
+
+	unpin_tag(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/* Compaction */
+
+/*
+ * Number of pages that could be freed if the objects of this class
+ * were packed densely. Called with class->lock held.
+ */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_wasted;
+
+	obj_wasted = class->zspages * class->objs_per_zspage -
+			class->objs_inuse;
+
+	return obj_wasted / class->objs_per_zspage * class->pages_per_zspage;
+}
+
+/*
+ * Move allocated objects from src into free slots of dst until src is
+ * empty or dst is full. Objects that are pinned (mapped or being
+ * freed) are left where they are. Called with class->lock held.
+ */
+static void migrate_zspage(struct zs_pool *pool, struct size_class *class,
+			   struct zspage *src, struct zspage *dst)
+{
+	unsigned int sidx, didx;
+	unsigned long head, handle;
+
+	for (sidx = 0; sidx < class->objs_per_zspage; sidx++) {
+		if (!src->inuse || dst->freeidx == OBJ_END)
+			break;
+
+		head = obj_read_header(src, sidx);
+		if (!(head & OBJ_ALLOCATED_TAG))
+			continue;
+
+		handle = head & ~OBJ_ALLOCATED_TAG;
+		if (!trypin_tag(handle))
+			continue;
+
+		didx = obj_malloc(class, dst, handle);
+		obj_move(src, sidx, dst, didx);
+		record_obj(handle, obj_location(dst, didx));
+		obj_free(class, src, sidx);
+		unpin_tag(handle);
+
+		atomic64_inc(&pool->objs_migrated);
+	}
+}
+
+static unsigned long zs_compact_class(struct zs_pool *pool,
+				      struct size_class *class)
+{
+	unsigned long nr_src, pages_freed = 0;
+	struct zspage *src, *dst = NULL;
+	struct list_head *sparse = &class->fullness_list[ZS_ALMOST_EMPTY];
+
+	spin_lock(&class->lock);
+	/* Bound the work so that pinned objects cannot make us spin */
+	nr_src = class->zspages;
+	while (nr_src-- && zs_can_compact(class) && !list_empty(sparse)) {
+		/* Empty the zspages that have been sparse the longest */
+		src = list_entry(sparse->prev, struct zspage, list);
+		list_del_init(&src->list);
+
+		while (src->inuse) {
+			dst = find_get_zspage(class);
+			if (!dst)
+				break;
+
+			migrate_zspage(pool, class, src, dst);
+			fix_fullness_group(class, dst);
+			if (dst->freeidx != OBJ_END)
+				break;		/* src has only pinned objects */
+		}
+
+		if (!src->inuse) {
+			class->zspages--;
+			spin_unlock(&class->lock);
+			free_zspage(pool, src);
+			pages_freed += class->pages_per_zspage;
+		} else {
+			/* Put it back at the head so we move on to another */
+			list_add(&src->list, sparse);
+			src->fullness = ZS_ALMOST_EMPTY;
+			fix_fullness_group(class, src);
+			spin_unlock(&class->lock);
+		}
+
+		/* Nowhere left to move objects to */
+		if (!dst)
+			return pages_freed;
+
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return pages_freed;
+}
+
+/**
+ * zs_compact - migrate objects out of sparse zspages and free them
+ * @pool: pool to compact
+ *
+ * Returns the number of pages freed. May sleep.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages_freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		pages_freed += zs_compact_class(pool, &pool->size_class[i]);
+
+	atomic64_add(pages_freed, &pool->pages_compacted);
+
+	return pages_freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+static unsigned long zs_compactable_pages(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		pages += zs_can_compact(class);
+		spin_unlock(&class->lock);
+	}
+
+	return pages;
+}
+
+static int zs_shrinker_shrink(struct shrinker *shrinker,
+			      struct shrink_control *sc)
+{
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+					    shrinker);
+
+	if (sc->nr_to_scan)
+		zs_compact(pool);
+
+	return min_t(unsigned long, zs_compactable_pages(pool), INT_MAX);
+}
+
+/* Pool */
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool to be created
+ * @flags: allocation flags used when growing the pool
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock_init(&class->lock);
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->index = i;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / class->size;
+	}
+
+	pool->name = name;
+	pool->flags = flags;
+	atomic_long_set(&pool->pages_allocated, 0);
+	atomic64_set(&pool->pages_compacted, 0);
+	atomic64_set(&pool->objs_migrated, 0);
+
+	pool->shrinker.shrink = zs_shrinker_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	unregister_shrinker(&pool->shrinker);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = &pool->size_class[i];
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			if (list_empty(&class->fullness_list[fg]))
+				continue;
+
+			pr_info("Freeing non-empty class with size %d, "
+				"fullness group %d\n", class->size, fg);
+		}
+	}
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/*
+ * Returns total memory used by allocator (userdata + metadata)
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+void zs_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	int i;
+
+	stats->pages_compacted = atomic64_read(&pool->pages_compacted);
+	stats->objs_migrated = atomic64_read(&pool->objs_migrated);
+	stats->obj_used_bytes = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		stats->obj_used_bytes += (u64)class->objs_inuse * class->size;
+		spin_unlock(&class->lock);
+	}
+}
+EXPORT_SYMBOL_GPL(zs_pool_stats);
+
+static void zs_free_map_areas(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		kfree(area->vm_buf);
+		area->vm_buf = NULL;
+	}
+}
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	BUILD_BUG_ON(ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE / ZS_MIN_ALLOC_SIZE
+			>= OBJ_END);
+
+	handle_cachep = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					  0, 0, NULL);
+	if (!handle_cachep)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->vm_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->vm_buf) {
+			zs_free_map_areas();
+			kmem_cache_destroy(handle_cachep);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static void __exit zs_exit(void)
+{
+	zs_free_map_areas();
+	kmem_cache_destroy(handle_cachep);
+}
+
+module_init(zs_init);
+module_exit(zs_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Memory allocator for compressed pages");
@@ -0,0 +1,120 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/shrinker.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/*
+ * A zspage is made of up to this many 0-order pages. Objects are
+ * laid out back to back across them, so an object may span two pages.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/*
+ * Every object starts with a header word. For allocated objects it
+ * holds the handle pointing back at the object (needed to migrate it
+ * during compaction) with OBJ_ALLOCATED_TAG set. For free objects it
+ * holds the index of the next free object in the zspage.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+#define OBJ_ALLOCATED_TAG	1
+#define OBJ_TAG_BITS		1
+
+/* Must be greater than ZS_HANDLE_SIZE and a multiple of the delta */
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are separated by ZS_SIZE_CLASS_DELTA bytes: 16 bytes
+ * for 4k pages, which keeps internal fragmentation per object small.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * Object location: <PFN of first zspage page, object index> packed in
+ * an unsigned long. The lowest bit is left free for HANDLE_PIN_BIT when
+ * the location is stored in a handle.
+ */
+#define OBJ_INDEX_BITS		(PAGE_SHIFT - 2)
+#define OBJ_INDEX_MASK		((1UL << OBJ_INDEX_BITS) - 1)
+#define OBJ_END			OBJ_INDEX_MASK	/* freelist terminator */
+#define HANDLE_PIN_BIT		0
+
+/*
+ * A zspage with at most this fraction of its objects in use is
+ * considered almost empty and is a candidate source for compaction.
+ */
+#define ZS_ALMOST_EMPTY_FRAC	4	/* i.e. 3/4 */
+
+enum fullness_group {
+	ZS_EMPTY,
+	ZS_ALMOST_EMPTY,
+	ZS_ALMOST_FULL,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+};
+
+struct size_class;
+
+struct zspage {
+	struct list_head list;		/* link in class fullness list */
+	struct size_class *class;
+	unsigned int inuse;		/* no. of allocated objects */
+	unsigned int freeidx;		/* first free object or OBJ_END */
+	enum fullness_group fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	int size;			/* object size incl. header */
+	unsigned int index;
+	int pages_per_zspage;
+	unsigned int objs_per_zspage;
+
+	/* stats, protected by lock */
+	unsigned long zspages;
+	unsigned long objs_inuse;
+};
+
+struct zs_pool {
+	const char *name;
+	gfp_t flags;			/* allocation flags for zspages */
+
+	struct size_class size_class[ZS_SIZE_CLASSES];
+
+	atomic_long_t pages_allocated;
+	atomic64_t pages_compacted;
+	atomic64_t objs_migrated;
+
+	/* compacts the pool when the VM asks for memory */
+	struct shrinker shrinker;
+};
+
+/*
+ * Per-CPU state of the current zs_map_object() mapping. Objects that
+ * span two pages are copied through vm_buf.
+ */
+struct mapping_area {
+	char *vm_buf;			/* copy buffer for spanning objects */
+	char *vm_addr;			/* kmap address if object not spanning */
+	enum zs_mapmode vm_mm;
+};
+
+#endif
@@ -971,6 +971,9 @@ static int de_thread(struct task_struct *tsk)
 		write_unlock_irq(&tasklist_lock);
 
 		release_task(leader);
+
+		/* Let oom_adj users that key on the leader see the new one */
+		oom_adj_changed(tsk);
 	}
 
 	sig->group_exit_task = NULL;
@@ -21,6 +21,7 @@
 
 #include <linux/sysfs.h>
 #include <linux/kobject.h>
+#include <linux/cpumask.h>
 
 #define CPUQUIET_NAME_LEN 16
 
@@ -39,12 +40,18 @@ struct cpuquiet_driver {
 	char			name[CPUQUIET_NAME_LEN];
 	int (*quiesence_cpu)	(unsigned int cpunumber);
 	int (*wake_cpu)		(unsigned int cpunumber);
+	/* Optional. Apply a batch of transitions, up before down */
+	int (*update_cpus)	(const struct cpumask *up,
+				 const struct cpumask *down);
 };
 
 extern int cpuquiet_register_governor(struct cpuquiet_governor *gov);
 extern void cpuquiet_unregister_governor(struct cpuquiet_governor *gov);
 extern int cpuquiet_quiesence_cpu(unsigned int cpunumber);
 extern int cpuquiet_wake_cpu(unsigned int cpunumber);
+extern int cpuquiet_request_cpus(const struct cpumask *up,
+				 const struct cpumask *down);
+extern void cpuquiet_flush_requests(void);
 extern int cpuquiet_register_driver(struct cpuquiet_driver *drv);
 extern void cpuquiet_unregister_driver(struct cpuquiet_driver *drv);
 extern int cpuquiet_add_group(struct attribute_group *attrs);
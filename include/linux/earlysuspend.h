@@ -29,6 +29,8 @@
  * the suspend handlers have already been called without a matching call to the
  * resume handlers, the suspend handler will be called directly from
  * register_early_suspend. This direct call can violate the normal level order.
+ * Handlers that share a level may be called concurrently; only the order
+ * between levels is guaranteed.
  */
 enum {
 	EARLY_SUSPEND_LEVEL_BLANK_SCREEN = 50,
@@ -41,6 +43,12 @@ struct early_suspend {
 	int level;
 	void (*suspend)(struct early_suspend *h);
 	void (*resume)(struct early_suspend *h);
+	struct {
+		unsigned long suspend_us;
+		unsigned long suspend_max_us;
+		unsigned long resume_us;
+		unsigned long resume_max_us;
+	} stat;
 #endif
 };
 
@@ -144,6 +144,15 @@ extern unsigned long avg_nr_running(void);
 extern unsigned long nr_iowait_cpu(int cpu);
 extern unsigned long this_cpu_load(void);
 
+#ifdef CONFIG_CPU_FREQ
+/* util is the recent busy fraction of the cpu, FIXED_1 for fully busy */
+struct sched_util_hook {
+	void (*func)(struct sched_util_hook *hook, unsigned long util);
+};
+
+extern void sched_set_util_hook(int cpu, struct sched_util_hook *hook);
+#endif
+
 
 extern void calc_global_load(unsigned long ticks);
 
@@ -1757,6 +1766,8 @@ extern void thread_group_times(struct task_struct *p, cputime_t *ut, cputime_t *
 
 extern int task_free_register(struct notifier_block *n);
 extern int task_free_unregister(struct notifier_block *n);
+extern int task_fork_register(struct notifier_block *n);
+extern int task_fork_unregister(struct notifier_block *n);
 
 /*
  * Per process flags
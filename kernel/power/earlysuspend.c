@@ -13,10 +13,13 @@
  *
  */
 
+#include <linux/async.h>
+#include <linux/debugfs.h>
 #include <linux/earlysuspend.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rtc.h>
+#include <linux/seq_file.h>
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #include <linux/workqueue.h>
@@ -35,8 +38,13 @@ static int debug_mask = DEBUG_USER_STATE;
 #endif
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
+/* run handlers that share a level concurrently */
+static int parallel = 1;
+module_param_named(parallel, parallel, int, S_IRUGO | S_IWUSR | S_IWGRP);
+
 static DEFINE_MUTEX(early_suspend_lock);
 static LIST_HEAD(early_suspend_handlers);
+static LIST_HEAD(early_suspend_domain);
 static void early_suspend(struct work_struct *work);
 static void late_resume(struct work_struct *work);
 static DECLARE_WORK(early_suspend_work, early_suspend);
@@ -53,6 +61,7 @@ void register_early_suspend(struct early_suspend *handler)
 {
 	struct list_head *pos;
 
+	memset(&handler->stat, 0, sizeof(handler->stat));
 	mutex_lock(&early_suspend_lock);
 	list_for_each(pos, &early_suspend_handlers) {
 		struct early_suspend *e;
@@ -75,11 +84,74 @@ void unregister_early_suspend(struct early_suspend *handler)
 }
 EXPORT_SYMBOL(unregister_early_suspend);
 
+static void call_early_suspend(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *h = data;
+	ktime_t start;
+	unsigned long us;
+
+	if (debug_mask & DEBUG_VERBOSE)
+		pr_info("early_suspend: calling %pf\n", h->suspend);
+	start = ktime_get();
+	h->suspend(h);
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+	h->stat.suspend_us = us;
+	if (us > h->stat.suspend_max_us)
+		h->stat.suspend_max_us = us;
+}
+
+static void call_late_resume(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *h = data;
+	ktime_t start;
+	unsigned long us;
+
+	if (debug_mask & DEBUG_VERBOSE)
+		pr_info("late_resume: calling %pf\n", h->resume);
+	start = ktime_get();
+	h->resume(h);
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+	h->stat.resume_us = us;
+	if (us > h->stat.resume_max_us)
+		h->stat.resume_max_us = us;
+}
+
+/* Caller must hold early_suspend_lock */
+static bool shares_level(struct early_suspend *h)
+{
+	struct early_suspend *prev, *next;
+
+	prev = list_entry(h->link.prev, struct early_suspend, link);
+	next = list_entry(h->link.next, struct early_suspend, link);
+	return (&prev->link != &early_suspend_handlers &&
+		prev->level == h->level) ||
+	       (&next->link != &early_suspend_handlers &&
+		next->level == h->level);
+}
+
+/*
+ * Call a handler, on the async domain if other handlers share its level.
+ * A change of level waits for everything scheduled at the previous one.
+ */
+static void call_handler(async_func_ptr *func, struct early_suspend *h,
+			 int *level)
+{
+	if (h->level != *level) {
+		async_synchronize_full_domain(&early_suspend_domain);
+		*level = h->level;
+	}
+	if (parallel && shares_level(h))
+		async_schedule_domain(func, h, &early_suspend_domain);
+	else
+		func(h, 0);
+}
+
 static void early_suspend(struct work_struct *work)
 {
 	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
+	int level = INT_MIN;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -99,12 +171,10 @@ static void early_suspend(struct work_struct *work)
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
 	list_for_each_entry(pos, &early_suspend_handlers, link) {
-		if (pos->suspend != NULL) {
-			if (debug_mask & DEBUG_VERBOSE)
-				pr_info("early_suspend: calling %pf\n", pos->suspend);
-			pos->suspend(pos);
-		}
+		if (pos->suspend != NULL)
+			call_handler(call_early_suspend, pos, &level);
 	}
+	async_synchronize_full_domain(&early_suspend_domain);
 	mutex_unlock(&early_suspend_lock);
 
 	if (debug_mask & DEBUG_SUSPEND)
@@ -123,6 +193,7 @@ static void late_resume(struct work_struct *work)
 	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
+	int level = INT_MIN;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -140,13 +211,10 @@ static void late_resume(struct work_struct *work)
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
 	list_for_each_entry_reverse(pos, &early_suspend_handlers, link) {
-		if (pos->resume != NULL) {
-			if (debug_mask & DEBUG_VERBOSE)
-				pr_info("late_resume: calling %pf\n", pos->resume);
-
-			pos->resume(pos);
-		}
+		if (pos->resume != NULL)
+			call_handler(call_late_resume, pos, &level);
 	}
+	async_synchronize_full_domain(&early_suspend_domain);
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: done\n");
 abort:
@@ -189,3 +257,49 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int early_suspend_stats_show(struct seq_file *s, void *data)
+{
+	struct early_suspend *pos;
+
+	seq_printf(s, "level\tsuspend_us\tsuspend_max_us\tresume_us"
+		   "\tresume_max_us\thandler\n");
+	mutex_lock(&early_suspend_lock);
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		seq_printf(s, "%d\t%lu\t%lu\t%lu\t%lu\t%pf/%pf\n",
+			   pos->level, pos->stat.suspend_us,
+			   pos->stat.suspend_max_us, pos->stat.resume_us,
+			   pos->stat.resume_max_us, pos->suspend, pos->resume);
+	mutex_unlock(&early_suspend_lock);
+	return 0;
+}
+
+static int early_suspend_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, early_suspend_stats_show, NULL);
+}
+
+static const struct file_operations early_suspend_stats_fops = {
+	.open		= early_suspend_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init early_suspend_debug_init(void)
+{
+	struct dentry *d;
+
+	d = debugfs_create_file("early_suspend_stats", 0444, NULL, NULL,
+		&early_suspend_stats_fops);
+	if (!d) {
+		pr_err("Failed to create early_suspend_stats debug file\n");
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+late_initcall(early_suspend_debug_init);
+#endif
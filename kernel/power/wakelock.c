@@ -45,8 +45,10 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 #define WAKE_LOCK_PREVENTING_SUSPEND     (1U << 11)
 
 static DEFINE_SPINLOCK(list_lock);
-static LIST_HEAD(inactive_locks);
-static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
+static LIST_HEAD(all_wake_locks);
+/* active locks without a timeout, and active locks ordered by expiry */
+static int active_count[WAKE_LOCK_TYPE_COUNT];
+static struct timerqueue_head expire_queue[WAKE_LOCK_TYPE_COUNT];
 static int current_event_num;
 struct workqueue_struct *suspend_work_queue;
 struct wake_lock main_wake_lock;
@@ -62,8 +64,23 @@ static unsigned suspend_short_count;
 #ifdef CONFIG_WAKELOCK_STAT
 static struct wake_lock deleted_wake_locks;
 static ktime_t last_sleep_time_update;
+static ktime_t sleep_wait_time;
+static int sleep_waiting;
 static int wait_for_wakeup;
 
+/*
+ * Total time spent waiting to suspend (main_wake_lock released) up to t.
+ * A suspend lock is charged the growth of this clock while it is active,
+ * so a change of main_wake_lock does not have to visit every active lock.
+ */
+static ktime_t sleep_wait_time_at(ktime_t t)
+{
+	if (sleep_waiting && t.tv64 > last_sleep_time_update.tv64)
+		return ktime_add(sleep_wait_time,
+				 ktime_sub(t, last_sleep_time_update));
+	return sleep_wait_time;
+}
+
 int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
 {
 	struct timespec ts;
@@ -110,7 +127,8 @@ static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
 		total_time = ktime_add(total_time, add_time);
 		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND)
 			prevent_suspend_time = ktime_add(prevent_suspend_time,
-					ktime_sub(now, last_sleep_time_update));
+					ktime_sub(sleep_wait_time_at(now),
+						  lock->stat.sleep_wait_mark));
 		if (add_time.tv64 > max_time.tv64)
 			max_time = add_time;
 	}
@@ -129,18 +147,13 @@ static int wakelock_stats_show(struct seq_file *m, void *unused)
 	unsigned long irqflags;
 	struct wake_lock *lock;
 	int ret;
-	int type;
 
 	spin_lock_irqsave(&list_lock, irqflags);
 
 	ret = seq_puts(m, "name\tcount\texpire_count\twake_count\tactive_since"
 			"\ttotal_time\tsleep_time\tmax_time\tlast_change\n");
-	list_for_each_entry(lock, &inactive_locks, link)
+	list_for_each_entry(lock, &all_wake_locks, link)
 		ret = print_lock_stat(m, lock);
-	for (type = 0; type < WAKE_LOCK_TYPE_COUNT; type++) {
-		list_for_each_entry(lock, &active_wake_locks[type], link)
-			ret = print_lock_stat(m, lock);
-	}
 	spin_unlock_irqrestore(&list_lock, irqflags);
 	return 0;
 }
@@ -164,7 +177,8 @@ static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 		lock->stat.max_time = duration;
 	lock->stat.last_time = ktime_get();
 	if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND) {
-		duration = ktime_sub(now, last_sleep_time_update);
+		duration = ktime_sub(sleep_wait_time_at(now),
+				     lock->stat.sleep_wait_mark);
 		lock->stat.prevent_suspend_time = ktime_add(
 			lock->stat.prevent_suspend_time, duration);
 		lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
@@ -173,40 +187,33 @@ static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 
 static void update_sleep_wait_stats_locked(int done)
 {
-	struct wake_lock *lock;
-	ktime_t now, etime, elapsed, add;
-	int expired;
-
-	now = ktime_get();
-	elapsed = ktime_sub(now, last_sleep_time_update);
-	list_for_each_entry(lock, &active_wake_locks[WAKE_LOCK_SUSPEND], link) {
-		expired = get_expired_time(lock, &etime);
-		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND) {
-			if (expired)
-				add = ktime_sub(etime, last_sleep_time_update);
-			else
-				add = elapsed;
-			lock->stat.prevent_suspend_time = ktime_add(
-				lock->stat.prevent_suspend_time, add);
-		}
-		if (done || expired)
-			lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
-		else
-			lock->flags |= WAKE_LOCK_PREVENTING_SUSPEND;
-	}
+	ktime_t now = ktime_get();
+
+	sleep_wait_time = sleep_wait_time_at(now);
+	sleep_waiting = !done;
 	last_sleep_time_update = now;
 }
 #endif
 
+/* Caller must acquire the list_lock spinlock */
+static void dequeue_wake_lock(struct wake_lock *lock)
+{
+	int type = lock->flags & WAKE_LOCK_TYPE_MASK;
+
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE)
+		timerqueue_del(&expire_queue[type], &lock->expire_node);
+	else if (lock->flags & WAKE_LOCK_ACTIVE)
+		active_count[type]--;
+}
+
 
 static void expire_wake_lock(struct wake_lock *lock)
 {
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 1);
 #endif
+	dequeue_wake_lock(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
-	list_add(&lock->link, &inactive_locks);
 	if (debug_mask & (DEBUG_WAKE_LOCK | DEBUG_EXPIRE))
 		pr_info("expired wake lock %s\n", lock->name);
 }
@@ -218,7 +225,10 @@ static void print_active_locks(int type)
 	bool print_expired = true;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry(lock, &active_wake_locks[type], link) {
+	list_for_each_entry(lock, &all_wake_locks, link) {
+		if ((lock->flags & WAKE_LOCK_TYPE_MASK) != type ||
+		    !(lock->flags & WAKE_LOCK_ACTIVE))
+			continue;
 		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
 			long timeout = lock->expires - jiffies;
 			if (timeout > 0)
@@ -236,21 +246,23 @@ static void print_active_locks(int type)
 
 static long has_wake_lock_locked(int type)
 {
-	struct wake_lock *lock, *n;
-	long max_timeout = 0;
+	struct timerqueue_node *node;
+	struct wake_lock *lock;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
-			return -1;
+	while ((node = timerqueue_getnext(&expire_queue[type]))) {
+		lock = container_of(node, struct wake_lock, expire_node);
+		if ((long)(lock->expires - jiffies) > 0)
+			break;
+		expire_wake_lock(lock);
 	}
-	return max_timeout;
+	if (active_count[type])
+		return -1;
+	if (!node)
+		return 0;
+	lock = container_of(rb_last(&expire_queue[type].head),
+			    struct wake_lock, expire_node.node);
+	return lock->expires - jiffies;
 }
 
 long has_wake_lock(int type)
@@ -320,6 +332,8 @@ static void suspend(struct work_struct *work)
 }
 static DECLARE_WORK(suspend_work, suspend);
 
+static long update_expire_timer_locked(const char *name);
+
 static void expire_wake_locks(unsigned long data)
 {
 	long has_lock;
@@ -329,15 +343,43 @@ static void expire_wake_locks(unsigned long data)
 	spin_lock_irqsave(&list_lock, irqflags);
 	if (debug_mask & DEBUG_SUSPEND)
 		print_active_locks(WAKE_LOCK_SUSPEND);
-	has_lock = has_wake_lock_locked(WAKE_LOCK_SUSPEND);
+	has_lock = update_expire_timer_locked("expire_wake_locks");
 	if (debug_mask & DEBUG_EXPIRE)
 		pr_info("expire_wake_locks: done, has_lock %ld\n", has_lock);
-	if (has_lock == 0)
-		queue_work(suspend_work_queue, &suspend_work);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 static DEFINE_TIMER(expire_timer, expire_wake_locks, 0, 0);
 
+/*
+ * Expire due suspend locks, point expire_timer at the next expiry and
+ * start a suspend attempt if no suspend lock is left.  The timer follows
+ * the earliest expiry rather than the latest so that expired locks are
+ * accounted when they expire.  Caller must acquire the list_lock spinlock.
+ */
+static long update_expire_timer_locked(const char *name)
+{
+	struct timerqueue_node *node;
+	unsigned long next;
+	long has_lock;
+
+	has_lock = has_wake_lock_locked(WAKE_LOCK_SUSPEND);
+	node = timerqueue_getnext(&expire_queue[WAKE_LOCK_SUSPEND]);
+	if (node) {
+		next = container_of(node, struct wake_lock,
+				    expire_node)->expires;
+		if (debug_mask & DEBUG_EXPIRE)
+			pr_info("%s, start expire timer, %ld\n", name,
+				(long)(next - jiffies));
+		mod_timer(&expire_timer, next);
+	} else if (del_timer(&expire_timer)) {
+		if (debug_mask & DEBUG_EXPIRE)
+			pr_info("%s, stop expire timer\n", name);
+	}
+	if (has_lock == 0)
+		queue_work(suspend_work_queue, &suspend_work);
+	return has_lock;
+}
+
 static int power_suspend_late(struct device *dev)
 {
 	int ret = has_wake_lock(WAKE_LOCK_SUSPEND) ? -EAGAIN : 0;
@@ -379,12 +421,14 @@ void wake_lock_init(struct wake_lock *lock, int type, const char *name)
 	lock->stat.prevent_suspend_time = ktime_set(0, 0);
 	lock->stat.max_time = ktime_set(0, 0);
 	lock->stat.last_time = ktime_set(0, 0);
+	lock->stat.sleep_wait_mark = ktime_set(0, 0);
 #endif
 	lock->flags = (type & WAKE_LOCK_TYPE_MASK) | WAKE_LOCK_INITIALIZED;
 
 	INIT_LIST_HEAD(&lock->link);
+	timerqueue_init(&lock->expire_node);
 	spin_lock_irqsave(&list_lock, irqflags);
-	list_add(&lock->link, &inactive_locks);
+	list_add(&lock->link, &all_wake_locks);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 EXPORT_SYMBOL(wake_lock_init);
@@ -411,6 +455,7 @@ void wake_lock_destroy(struct wake_lock *lock)
 				  lock->stat.max_time);
 	}
 #endif
+	dequeue_wake_lock(lock);
 	list_del(&lock->link);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
@@ -421,7 +466,6 @@ static void wake_lock_internal(
 {
 	int type;
 	unsigned long irqflags;
-	long expire_in;
 
 	spin_lock_irqsave(&list_lock, irqflags);
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
@@ -440,27 +484,28 @@ static void wake_lock_internal(
 		lock->stat.last_time = ktime_get();
 	}
 #endif
+	dequeue_wake_lock(lock);
 	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
 		lock->flags |= WAKE_LOCK_ACTIVE;
 #ifdef CONFIG_WAKELOCK_STAT
 		lock->stat.last_time = ktime_get();
 #endif
 	}
-	list_del(&lock->link);
 	if (has_timeout) {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d, timeout %ld.%03lu\n",
 				lock->name, type, timeout / HZ,
 				(timeout % HZ) * MSEC_PER_SEC / HZ);
 		lock->expires = jiffies + timeout;
+		lock->expire_node.expires.tv64 = get_jiffies_64() + timeout;
 		lock->flags |= WAKE_LOCK_AUTO_EXPIRE;
-		list_add_tail(&lock->link, &active_wake_locks[type]);
+		timerqueue_add(&expire_queue[type], &lock->expire_node);
 	} else {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d\n", lock->name, type);
 		lock->expires = LONG_MAX;
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
-		list_add(&lock->link, &active_wake_locks[type]);
+		active_count[type]++;
 	}
 	if (type == WAKE_LOCK_SUSPEND) {
 		current_event_num++;
@@ -469,24 +514,13 @@ static void wake_lock_internal(
 			update_sleep_wait_stats_locked(1);
 		else if (!wake_lock_active(&main_wake_lock))
 			update_sleep_wait_stats_locked(0);
-#endif
-		if (has_timeout)
-			expire_in = has_wake_lock_locked(type);
-		else
-			expire_in = -1;
-		if (expire_in > 0) {
-			if (debug_mask & DEBUG_EXPIRE)
-				pr_info("wake_lock: %s, start expire timer, "
-					"%ld\n", lock->name, expire_in);
-			mod_timer(&expire_timer, jiffies + expire_in);
-		} else {
-			if (del_timer(&expire_timer))
-				if (debug_mask & DEBUG_EXPIRE)
-					pr_info("wake_lock: %s, stop expire timer\n",
-						lock->name);
-			if (expire_in == 0)
-				queue_work(suspend_work_queue, &suspend_work);
+		if (!(lock->flags & WAKE_LOCK_PREVENTING_SUSPEND)) {
+			lock->flags |= WAKE_LOCK_PREVENTING_SUSPEND;
+			lock->stat.sleep_wait_mark =
+				sleep_wait_time_at(ktime_get());
 		}
+#endif
+		update_expire_timer_locked(lock->name);
 	}
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
@@ -514,24 +548,10 @@ void wake_unlock(struct wake_lock *lock)
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	dequeue_wake_lock(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
-	list_add(&lock->link, &inactive_locks);
 	if (type == WAKE_LOCK_SUSPEND) {
-		long has_lock = has_wake_lock_locked(type);
-		if (has_lock > 0) {
-			if (debug_mask & DEBUG_EXPIRE)
-				pr_info("wake_unlock: %s, start expire timer, "
-					"%ld\n", lock->name, has_lock);
-			mod_timer(&expire_timer, jiffies + has_lock);
-		} else {
-			if (del_timer(&expire_timer))
-				if (debug_mask & DEBUG_EXPIRE)
-					pr_info("wake_unlock: %s, stop expire "
-						"timer\n", lock->name);
-			if (has_lock == 0)
-				queue_work(suspend_work_queue, &suspend_work);
-		}
+		update_expire_timer_locked(lock->name);
 		if (lock == &main_wake_lock) {
 			if (debug_mask & DEBUG_SUSPEND)
 				print_active_locks(WAKE_LOCK_SUSPEND);
@@ -568,8 +588,8 @@ static int __init wakelocks_init(void)
 	int ret;
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++)
-		INIT_LIST_HEAD(&active_wake_locks[i]);
+	for (i = 0; i < ARRAY_SIZE(expire_queue); i++)
+		timerqueue_init_head(&expire_queue[i]);
 
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_lock_init(&deleted_wake_locks, WAKE_LOCK_SUSPEND,
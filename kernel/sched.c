@@ -475,6 +475,7 @@ struct rq {
 	/* time-based average load */
 	u64 nr_last_stamp;
 	unsigned int ave_nr_running;
+	unsigned int ave_util;
 	seqcount_t ave_seqcnt;
 
 	/* capture load from *all* tasks on this cpu: */
@@ -1788,10 +1789,37 @@ static inline unsigned int do_avg_nr_running(struct rq *rq)
 	return ave_nr_running;
 }
 
+/*
+ * Busy fraction of the cpu, FIXED_1 when it always had something to run,
+ * averaged the same way over a shorter period so that it follows load
+ * within a couple of ticks:
+ * 24 ~=  16777216ns =  16.8ms
+ */
+#define UTIL_AVE_PERIOD_EXP	24
+#define UTIL_AVE_PERIOD		(1 << UTIL_AVE_PERIOD_EXP)
+#define UTIL_AVE_DIV_PERIOD(x)	((x) >> UTIL_AVE_PERIOD_EXP)
+
+static inline unsigned int do_avg_util(struct rq *rq)
+{
+	s64 busy, deltax;
+	unsigned int ave_util = rq->ave_util;
+
+	deltax = rq->clock_task - rq->nr_last_stamp;
+	busy = rq->nr_running ? FIXED_1 : 0;
+
+	if (deltax > UTIL_AVE_PERIOD)
+		ave_util = busy;
+	else
+		ave_util += UTIL_AVE_DIV_PERIOD(deltax * (busy - ave_util));
+
+	return ave_util;
+}
+
 static void inc_nr_running(struct rq *rq)
 {
 	write_seqcount_begin(&rq->ave_seqcnt);
 	rq->ave_nr_running = do_avg_nr_running(rq);
+	rq->ave_util = do_avg_util(rq);
 	rq->nr_last_stamp = rq->clock_task;
 	rq->nr_running++;
 	write_seqcount_end(&rq->ave_seqcnt);
@@ -1801,6 +1829,7 @@ static void dec_nr_running(struct rq *rq)
 {
 	write_seqcount_begin(&rq->ave_seqcnt);
 	rq->ave_nr_running = do_avg_nr_running(rq);
+	rq->ave_util = do_avg_util(rq);
 	rq->nr_last_stamp = rq->clock_task;
 	rq->nr_running--;
 	write_seqcount_end(&rq->ave_seqcnt);
@@ -3334,6 +3363,33 @@ unsigned long get_avg_nr_running(unsigned int cpu)
 	return q->ave_nr_running;
 }
 
+#ifdef CONFIG_CPU_FREQ
+static DEFINE_PER_CPU(struct sched_util_hook *, sched_util_hook);
+
+/*
+ * Have hook->func() called from the scheduler tick of cpu with its
+ * utilization, or stop with a NULL hook. The callback runs in hardirq
+ * context without runqueue locks held. Callers must synchronize_sched()
+ * after clearing a hook before freeing it.
+ */
+void sched_set_util_hook(int cpu, struct sched_util_hook *hook)
+{
+	rcu_assign_pointer(per_cpu(sched_util_hook, cpu), hook);
+}
+EXPORT_SYMBOL_GPL(sched_set_util_hook);
+
+static inline void sched_util_update(int cpu, unsigned long util)
+{
+	struct sched_util_hook *hook;
+
+	hook = rcu_dereference_sched(per_cpu(sched_util_hook, cpu));
+	if (hook)
+		hook->func(hook, util);
+}
+#else
+static inline void sched_util_update(int cpu, unsigned long util) { }
+#endif
+
 unsigned long nr_iowait_cpu(int cpu)
 {
 	struct rq *this = cpu_rq(cpu);
@@ -4184,6 +4240,7 @@ void scheduler_tick(void)
 	int cpu = smp_processor_id();
 	struct rq *rq = cpu_rq(cpu);
 	struct task_struct *curr = rq->curr;
+	unsigned long util;
 
 	sched_clock_tick();
 
@@ -4191,8 +4248,11 @@ void scheduler_tick(void)
 	update_rq_clock(rq);
 	update_cpu_load_active(rq);
 	curr->sched_class->task_tick(rq, curr, 0);
+	util = do_avg_util(rq);
 	raw_spin_unlock(&rq->lock);
 
+	sched_util_update(cpu, util);
+
 	perf_event_task_tick();
 
 #ifdef CONFIG_SMP
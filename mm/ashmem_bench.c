@@ -0,0 +1,256 @@
+/* mm/ashmem_bench.c
+**
+** Microbenchmark for ashmem pin/unpin range tracking
+**
+** Copyright (C) 2026 agent <agent@local>
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** Loading the module opens /dev/ashmem from the loading process and drives
+** ASHMEM_UNPIN, ASHMEM_GET_PIN_STATUS and ASHMEM_PIN through a few
+** fragmentation patterns, printing the mean cost of each ioctl. The module
+** intentionally fails to load with -EAGAIN so it can be run again.
+*/
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/err.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
+#include <linux/ashmem.h>
+
+static char *dev = "/dev/ashmem";
+module_param(dev, charp, S_IRUGO);
+MODULE_PARM_DESC(dev, "ashmem device node");
+
+static unsigned int pages = 4096;
+module_param(pages, uint, S_IRUGO);
+MODULE_PARM_DESC(pages, "size of the benchmarked area, in pages");
+
+static unsigned int queries = 16384;
+module_param(queries, uint, S_IRUGO);
+MODULE_PARM_DESC(queries, "random ASHMEM_GET_PIN_STATUS calls per pattern");
+
+struct bench_stat {
+	unsigned long calls;
+	s64 ns;
+};
+
+struct bench_pattern {
+	const char *name;
+	void (*unpin)(struct file *file, unsigned int *order);
+	void (*pin)(struct file *file, unsigned int *order);
+};
+
+static struct bench_stat unpin_stat, status_stat, pin_stat;
+
+static long bench_ioctl(struct file *file, unsigned int cmd,
+			size_t pgstart, size_t npages, struct bench_stat *stat)
+{
+	struct ashmem_pin pin = {
+		.offset = pgstart * PAGE_SIZE,
+		.len = npages * PAGE_SIZE,
+	};
+	mm_segment_t old_fs;
+	ktime_t start;
+	long ret;
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	start = ktime_get();
+	ret = file->f_op->unlocked_ioctl(file, cmd, (unsigned long) &pin);
+	stat->ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	stat->calls++;
+	set_fs(old_fs);
+
+	return ret;
+}
+
+/* random permutation of 0..n-1 */
+static void bench_shuffle(unsigned int *order, unsigned int n)
+{
+	unsigned int i, j, tmp;
+
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	for (i = n - 1; i > 0; i--) {
+		j = random32() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+}
+
+/* every other page unpinned: pages / 2 ranges that never merge */
+static void unpin_sparse(struct file *file, unsigned int *order)
+{
+	unsigned int i;
+
+	for (i = 0; i < pages; i += 2)
+		bench_ioctl(file, ASHMEM_UNPIN, i, 1, &unpin_stat);
+}
+
+/* single pages in random order: ranges appear, overlap and merge */
+static void unpin_scatter(struct file *file, unsigned int *order)
+{
+	unsigned int i;
+
+	bench_shuffle(order, pages);
+	for (i = 0; i < pages; i++)
+		bench_ioctl(file, ASHMEM_UNPIN, order[i], 1, &unpin_stat);
+}
+
+/* overlapping three-page windows: every unpin merges with its neighbour */
+static void unpin_overlap(struct file *file, unsigned int *order)
+{
+	unsigned int i;
+
+	for (i = 0; i + 3 <= pages; i += 2)
+		bench_ioctl(file, ASHMEM_UNPIN, i, 3, &unpin_stat);
+}
+
+/* one range covering everything, to be punched full of holes */
+static void unpin_all(struct file *file, unsigned int *order)
+{
+	bench_ioctl(file, ASHMEM_UNPIN, 0, pages, &unpin_stat);
+}
+
+/* pin single pages in random order */
+static void pin_scatter(struct file *file, unsigned int *order)
+{
+	unsigned int i;
+
+	bench_shuffle(order, pages);
+	for (i = 0; i < pages; i++)
+		bench_ioctl(file, ASHMEM_PIN, order[i], 1, &pin_stat);
+}
+
+/* pin every other page, splitting ranges, then the rest */
+static void pin_punch(struct file *file, unsigned int *order)
+{
+	unsigned int i;
+
+	for (i = 1; i < pages; i += 2)
+		bench_ioctl(file, ASHMEM_PIN, i, 1, &pin_stat);
+	for (i = 0; i < pages; i += 2)
+		bench_ioctl(file, ASHMEM_PIN, i, 1, &pin_stat);
+}
+
+static const struct bench_pattern patterns[] = {
+	{ "sparse",	unpin_sparse,	pin_scatter },
+	{ "scatter",	unpin_scatter,	pin_scatter },
+	{ "overlap",	unpin_overlap,	pin_punch },
+	{ "punch",	unpin_all,	pin_punch },
+};
+
+static s64 bench_mean(struct bench_stat *stat)
+{
+	return stat->calls ? div64_u64(stat->ns, stat->calls) : 0;
+}
+
+static int bench_setup(struct file **filep)
+{
+	unsigned long size = (unsigned long) pages * PAGE_SIZE;
+	unsigned long addr;
+	struct file *file;
+	long ret;
+
+	file = filp_open(dev, O_RDWR, 0);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+
+	ret = file->f_op->unlocked_ioctl(file, ASHMEM_SET_SIZE, size);
+	if (ret)
+		goto err;
+
+	/* the backing file, needed for pinning, is created on first mmap */
+	down_write(&current->mm->mmap_sem);
+	addr = do_mmap(file, 0, size, PROT_READ | PROT_WRITE, MAP_SHARED, 0);
+	if (!IS_ERR_VALUE(addr))
+		do_munmap(current->mm, addr, size);
+	up_write(&current->mm->mmap_sem);
+	if (IS_ERR_VALUE(addr)) {
+		ret = addr;
+		goto err;
+	}
+
+	*filep = file;
+	return 0;
+
+err:
+	filp_close(file, NULL);
+	return ret;
+}
+
+static int __init ashmem_bench_init(void)
+{
+	unsigned int *order;
+	unsigned int i, j;
+	int ret;
+
+	if (!current->mm || pages < 4)
+		return -EINVAL;
+
+	order = kmalloc(pages * sizeof(*order), GFP_KERNEL);
+	if (!order)
+		return -ENOMEM;
+
+	printk(KERN_INFO "ashmem_bench: %u pages, %u queries per pattern\n",
+	       pages, queries);
+
+	for (i = 0; i < ARRAY_SIZE(patterns); i++) {
+		struct file *file;
+
+		ret = bench_setup(&file);
+		if (ret) {
+			printk(KERN_ERR "ashmem_bench: cannot set up %s: %d\n",
+			       dev, ret);
+			goto out;
+		}
+
+		memset(&unpin_stat, 0, sizeof(unpin_stat));
+		memset(&status_stat, 0, sizeof(status_stat));
+		memset(&pin_stat, 0, sizeof(pin_stat));
+
+		patterns[i].unpin(file, order);
+		for (j = 0; j < queries; j++)
+			bench_ioctl(file, ASHMEM_GET_PIN_STATUS,
+				    random32() % pages, 1, &status_stat);
+		patterns[i].pin(file, order);
+
+		printk(KERN_INFO "ashmem_bench: %-8s unpin %lu x %lldns "
+		       "status %lu x %lldns pin %lu x %lldns\n",
+		       patterns[i].name,
+		       unpin_stat.calls, bench_mean(&unpin_stat),
+		       status_stat.calls, bench_mean(&status_stat),
+		       pin_stat.calls, bench_mean(&pin_stat));
+
+		filp_close(file, NULL);
+		cond_resched();
+	}
+
+	/* don't stay loaded, so the benchmark can simply be run again */
+	ret = -EAGAIN;
+out:
+	kfree(order);
+	return ret;
+}
+
+module_init(ashmem_bench_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("ashmem pin/unpin microbenchmark");
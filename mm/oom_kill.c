@@ -585,6 +585,38 @@ int unregister_oom_notifier(struct notifier_block *nb)
 }
 EXPORT_SYMBOL_GPL(unregister_oom_notifier);
 
+static ATOMIC_NOTIFIER_HEAD(oom_adj_notify_list);
+
+/*
+ * The oom_adj notifiers are called with the new oom_adj and the task whenever
+ * userspace changes the oom_adj or oom_score_adj of a thread group, and when
+ * an exec from a non-leader thread makes that thread the group leader.
+ */
+int register_oom_adj_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(register_oom_adj_notifier);
+
+int unregister_oom_adj_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_oom_adj_notifier);
+
+/*
+ * The caller only holds a reference on 'tsk', not on its group leader, so the
+ * chain is run under rcu_read_lock() to keep tsk->group_leader from being
+ * freed while a notifier looks at it.
+ */
+void oom_adj_changed(struct task_struct *tsk)
+{
+	rcu_read_lock();
+	atomic_notifier_call_chain(&oom_adj_notify_list,
+				   tsk->signal->oom_adj, tsk);
+	rcu_read_unlock();
+}
+
 /*
  * Try to acquire the OOM killer lock for the zones in zonelist.  Returns zero
  * if a parallel OOM killing is already taking place that includes a zone in